@@ -0,0 +1,256 @@
+/*
+ * Reader for the "Game Music Files" (.gamemusic) container
+ *
+ * See gamemusic.h for a description of the format.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gamemusic.h"
+
+#define HEADER_SIZE (CONTAINER_STRING_SIZE + 4)
+
+static unsigned int read_be32(const unsigned char *p)
+{
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+int gamemusic_is_container(const char *filename)
+{
+  char signature_check[CONTAINER_STRING_SIZE];
+  FILE *f;
+  int ret;
+
+  f = fopen(filename, "rb");
+  if (!f)
+    return -1;
+  if (fread(signature_check, CONTAINER_STRING_SIZE, 1, f) != 1)
+    ret = 0;  /* too small to be a container; let GME have a go at it */
+  else
+    ret = (strncmp(signature_check, CONTAINER_STRING,
+      CONTAINER_STRING_SIZE) == 0);
+  fclose(f);
+
+  return ret;
+}
+
+int gamemusic_open(gamemusic_t *gm, const char *filename)
+{
+  struct stat st;
+  void *map;
+  int fd;
+  unsigned int count;
+
+  memset(gm, 0, sizeof(gamemusic_t));
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(filename);
+    return 2;
+  }
+  if (fstat(fd, &st) < 0)
+  {
+    perror(filename);
+    close(fd);
+    return 2;
+  }
+  if (st.st_size < HEADER_SIZE)
+  {
+    printf("%s: truncated container\n", filename);
+    close(fd);
+    return 2;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    perror(filename);
+    return 3;
+  }
+
+  gm->data = (const unsigned char *)map;
+  gm->size = st.st_size;
+
+  if (strncmp((const char *)gm->data, CONTAINER_STRING,
+    CONTAINER_STRING_SIZE) != 0)
+  {
+    printf("%s: not a .gamemusic container\n", filename);
+    gamemusic_close(gm);
+    return 2;
+  }
+
+  /* make sure the whole offset table lies within the file */
+  count = read_be32(&gm->data[CONTAINER_STRING_SIZE]);
+  if (count > (gm->size - HEADER_SIZE) / 4)
+  {
+    printf("%s: bad entry count (%u)\n", filename, count);
+    gamemusic_close(gm);
+    return 2;
+  }
+  gm->entry_count = count;
+
+  return 0;
+}
+
+void gamemusic_close(gamemusic_t *gm)
+{
+  if (gm->data)
+    munmap((void *)gm->data, gm->size);
+  memset(gm, 0, sizeof(gamemusic_t));
+}
+
+int gamemusic_entry(const gamemusic_t *gm, int index,
+  const unsigned char **data, size_t *size)
+{
+  const unsigned char *table;
+  size_t start, end;
+
+  if (index < 0 || index >= gm->entry_count)
+    return 1;
+
+  /* entries are stored back to back, so an entry runs up to the start of
+   * the next one (or to the end of the file for the last entry) */
+  table = &gm->data[HEADER_SIZE];
+  start = read_be32(&table[index * 4]);
+  if (index < gm->entry_count - 1)
+    end = read_be32(&table[(index + 1) * 4]);
+  else
+    end = gm->size;
+
+  if (start >= end || end > gm->size)
+    return 2;
+
+  *data = &gm->data[start];
+  *size = end - start;
+
+  return 0;
+}
+
+gme_err_t gamemusic_open_emu(const gamemusic_t *gm, int index,
+  Music_Emu **emu, int sample_rate)
+{
+  const unsigned char *data;
+  size_t size;
+
+  if (gamemusic_entry(gm, index, &data, &size))
+    return "Invalid .gamemusic entry";
+
+  return gme_open_data(data, size, emu, sample_rate);
+}
+
+/* Make a container entry the one in player->emu, without starting it */
+static gme_err_t load_entry(gamemusic_player_t *player, int entry)
+{
+  Music_Emu *emu;
+  gme_err_t err;
+
+  if (entry == player->entry)
+    return NULL;
+
+  err = gamemusic_open_emu(&player->container, entry, &emu,
+    player->sample_rate);
+  if (err)
+    return err;
+  if (player->emu)
+    gme_delete(player->emu);
+  player->emu = emu;
+  player->entry = entry;
+
+  return NULL;
+}
+
+gme_err_t gamemusic_player_open(gamemusic_player_t *player,
+  const char *filename, int sample_rate)
+{
+  gme_err_t err;
+  int ret;
+
+  memset(player, 0, sizeof(gamemusic_player_t));
+  player->sample_rate = sample_rate;
+  player->entry = -1;
+
+  ret = gamemusic_is_container(filename);
+  if (ret < 0)
+    return "Couldn't open file";
+  player->is_container = ret;
+
+  if (!player->is_container)
+    return gme_open_file(filename, &player->emu, sample_rate);
+
+  if (gamemusic_open(&player->container, filename))
+    return "Couldn't open .gamemusic container";
+  if (player->container.entry_count == 0)
+  {
+    gamemusic_close(&player->container);
+    return "Empty .gamemusic container";
+  }
+
+  /* load the first entry up front so that player->emu is always valid;
+   * it isn't started, as an info-only emulator can't be */
+  err = load_entry(player, 0);
+  if (err)
+    gamemusic_player_close(player);
+
+  return err;
+}
+
+void gamemusic_player_close(gamemusic_player_t *player)
+{
+  if (player->emu)
+    gme_delete(player->emu);
+  if (player->is_container)
+    gamemusic_close(&player->container);
+  memset(player, 0, sizeof(gamemusic_player_t));
+}
+
+int gamemusic_player_track_count(const gamemusic_player_t *player)
+{
+  if (player->is_container)
+    return player->container.entry_count;
+  else
+    return gme_track_count(player->emu);
+}
+
+gme_err_t gamemusic_player_track_info(gamemusic_player_t *player,
+  gme_info_t **info, int track)
+{
+  Music_Emu *info_emu;
+  gme_err_t err;
+
+  if (!player->is_container)
+    return gme_track_info(player->emu, info, track);
+
+  if (track == player->entry)
+    return gme_track_info(player->emu, info, 0);
+
+  /* some other entry; a throwaway info-only emulator is cheap */
+  err = gamemusic_open_emu(&player->container, track, &info_emu,
+    gme_info_only);
+  if (err)
+    return err;
+  err = gme_track_info(info_emu, info, 0);
+  gme_delete(info_emu);
+
+  return err;
+}
+
+gme_err_t gamemusic_player_start_track(gamemusic_player_t *player, int track)
+{
+  gme_err_t err;
+
+  if (!player->is_container)
+    return gme_start_track(player->emu, track);
+
+  err = load_entry(player, track);
+  if (err)
+    return err;
+
+  return gme_start_track(player->emu, 0);
+}
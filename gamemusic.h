@@ -0,0 +1,78 @@
+/*
+ * Reader for the "Game Music Files" (.gamemusic) container
+ *
+ * A .gamemusic file, as written by repack-rsn.py and repack-vgm-7z.py, is
+ * laid out as:
+ *
+ *   bytes 0-15:  "Game Music Files" signature
+ *   bytes 16-19: number of entries (big endian)
+ *   next N * 4:  absolute offset of each entry (big endian)
+ *   ...:         entry data, back to back, in offset order
+ *
+ * The file is mapped into memory and entries are handed to GME straight
+ * from the mapping, so looking up an entry is a single read of the offset
+ * table.
+ *
+ * The gamemusic_player_* functions wrap either a container or a
+ * conventional GME file behind one track list so that the players don't
+ * need to care which kind of file they were given.
+ */
+#ifndef GAMEMUSIC_H
+#define GAMEMUSIC_H
+
+#include <stddef.h>
+
+#include <gme/gme.h>
+
+#define CONTAINER_STRING "Game Music Files"
+#define CONTAINER_STRING_SIZE 16
+
+typedef struct
+{
+  const unsigned char *data;
+  size_t size;
+  int entry_count;
+} gamemusic_t;
+
+typedef struct
+{
+  gamemusic_t container;
+  int is_container;
+  int sample_rate;
+  Music_Emu *emu;
+  int entry;  /* container entry currently loaded in emu; -1 if none */
+} gamemusic_player_t;
+
+/* Returns 1 if the file carries the container signature, 0 if not, and -1
+ * if the file could not be read. */
+int gamemusic_is_container(const char *filename);
+
+/* Map a container file; returns 0 on success. */
+int gamemusic_open(gamemusic_t *gm, const char *filename);
+void gamemusic_close(gamemusic_t *gm);
+
+/* Locate an entry within the mapping; returns 0 on success. */
+int gamemusic_entry(const gamemusic_t *gm, int index,
+  const unsigned char **data, size_t *size);
+
+/* Create an emulator for a single entry, played directly from the
+ * mapping. The mapping must outlive the emulator. */
+gme_err_t gamemusic_open_emu(const gamemusic_t *gm, int index,
+  Music_Emu **emu, int sample_rate);
+
+/* Open either kind of file as a flat list of tracks. With a sample rate of
+ * gme_info_only, only the track info is available: tracks can't be started
+ * (libgme won't play an info-only emulator). */
+gme_err_t gamemusic_player_open(gamemusic_player_t *player,
+  const char *filename, int sample_rate);
+void gamemusic_player_close(gamemusic_player_t *player);
+int gamemusic_player_track_count(const gamemusic_player_t *player);
+gme_err_t gamemusic_player_track_info(gamemusic_player_t *player,
+  gme_info_t **info, int track);
+
+/* Start a track (0-based). For a container this may replace player->emu,
+ * so callers must not hold on to the old pointer, and any per-emulator
+ * state such as muted voices has to be applied again afterwards. */
+gme_err_t gamemusic_player_start_track(gamemusic_player_t *player, int track);
+
+#endif  /* GAMEMUSIC_H */
@@ -6,13 +6,19 @@
  *   http://equalarea.com/paul/alsa-audio.html
  * 
  * Compile using:
- *   gcc -Wall gme-alsa.c -o gme-alsa -lgme -lasound
+ *   gcc -Wall gme-alsa.c gamemusic.c loudness.c renderahead.c -o gme-alsa \
+ *     -lgme -lasound -lm -lpthread
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <gme/gme.h>
 
+#include "gamemusic.h"
+#include "loudness.h"
+#include "renderahead.h"
+
 #ifdef __linux__
 #include <alsa/asoundlib.h>
 #else
@@ -24,22 +30,57 @@
 #define CHANNELS 2
 #define BUFFER_SIZE 1024
 #define ALSA_DEVICE "default"
+/* seconds of audio to keep rendered ahead of the device */
+#define RENDER_AHEAD 3
+/* a stream is only ever rendered by one worker at a time, and each player
+ * has a single stream */
+#define RENDER_THREADS 1
 
 int main(int argc, char *argv[])
 {
   snd_pcm_t *playback_handle;
   snd_pcm_hw_params_t *hw_params;
   int err;
+  gamemusic_player_t player;
   Music_Emu *emu;
   gme_info_t *info;
   gme_err_t gmeErr;
   int track;
-  short audio_buffer[BUFFER_SIZE];
+  const short *audio_buffer;
+  int audio_samples;
   unsigned int sample_rate;
+  renderahead_pool_t *render_pool;
+  renderahead_stream_t *render_stream;
+  int render_ahead = RENDER_AHEAD;
+  int verbose = 0;
+  int normalize = 1;
+  loudness_t loudness;
+  int gain;
+  int chunks_played;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:nv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a':
+        render_ahead = atoi(optarg);
+        break;
+      case 'n':
+        normalize = 0;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
 
-  if (argc < 2)
+  if (argc - optind < 1)
   {
-    printf("USAGE: gme-alsa <game music file> [track number]\n");
+    printf("USAGE: gme-alsa [-a render-ahead seconds] [-n] [-v] <game music file> [track number]\n");
     return 1;
   }
 
@@ -119,27 +160,27 @@ int main(int argc, char *argv[])
 
   /* initialize GME based on parameter; open GME after opening ALSA since
    * ALSA might return a different sample rate */
-  gmeErr = gme_open_file(argv[1], &emu, sample_rate);
+  gmeErr = gamemusic_player_open(&player, argv[optind], sample_rate);
   if (gmeErr)
   {
     printf("%s\n", gmeErr);
     snd_pcm_close(playback_handle);
     return 1;
   }
-  if (argc >= 3)
-    track = atoi(argv[2]);
+  if (argc - optind >= 2)
+    track = atoi(argv[optind + 1]);
   else
     track = 0;
-  if (track < 0 || track > gme_track_count(emu))
+  if (track < 0 || track >= gamemusic_player_track_count(&player))
   {
     printf("there is no track %d; playing track 0 instead\n", track);
     track = 0;
   }
-  gmeErr = gme_track_info(emu, &info, track);
+  gmeErr = gamemusic_player_track_info(&player, &info, track);
   if (gmeErr)
   {
     printf("%s\n", gmeErr);
-    gme_delete(emu);
+    gamemusic_player_close(&player);
     snd_pcm_close(playback_handle);
     return 2;
   }
@@ -155,30 +196,76 @@ int main(int argc, char *argv[])
 
   printf("system: %s\ngame: %s\nsong: %s\nlength: %d ms\nplay length: %d ms\nplaying track %d...\nCtrl-C to exit\n",
     info->system, info->game, info->song, info->length, info->play_length, track);
-  gme_start_track(emu, track);
+  gmeErr = gamemusic_player_start_track(&player, track);
+  if (gmeErr)
+  {
+    printf("%s\n", gmeErr);
+    gme_free_info(info);
+    gamemusic_player_close(&player);
+    snd_pcm_close(playback_handle);
+    return 2;
+  }
+  emu = player.emu;
 
-  do
+  /* bring the track to a common level if gme-loudness has measured it */
+  gain = LOUDNESS_GAIN_UNITY;
+  if (normalize && !loudness_read_track(argv[optind], track, &loudness))
   {
-    gmeErr = gme_play(emu, BUFFER_SIZE, audio_buffer);
-    if (gmeErr)
-    {
-      printf("%s\n", gmeErr);
-      break;
-    }
-    err = snd_pcm_writei(playback_handle, audio_buffer, BUFFER_SIZE / 2);
-    if (err != (BUFFER_SIZE / 2))
+    gain = loudness_gain_to_fixed(loudness.gain);
+    printf("loudness: %.1f LUFS; applying %+.1f dB gain\n",
+      loudness.loudness, loudness.gain);
+  }
+
+  /* emulate on worker threads; this thread only feeds the device */
+  render_stream = NULL;
+  render_pool = renderahead_pool_create(RENDER_THREADS);
+  if (render_pool)
+    render_stream = renderahead_stream_create(render_pool, emu,
+      info->play_length, gain, BUFFER_SIZE,
+      render_ahead * sample_rate * CHANNELS / BUFFER_SIZE);
+  if (!render_pool || !render_stream)
+  {
+    printf("could not set up render-ahead buffers\n");
+    exit(1);
+  }
+
+  chunks_played = 0;
+  while ((audio_buffer = renderahead_dequeue(render_stream, &audio_samples, 1)))
+  {
+    err = snd_pcm_writei(playback_handle, audio_buffer, audio_samples / 2);
+    if (err != (audio_samples / 2))
     {
       printf("write to audio interface failed (%s)\n",
         snd_strerror(err));
       exit(1);
     }
-  } while (gme_tell(emu) < info->play_length);
+    renderahead_release(render_stream);
+
+    /* report the queue depth about once a second; the dequeue blocks, so
+     * an empty queue just means a wait while the device plays what it
+     * already has, not an underrun */
+    chunks_played++;
+    if (verbose && chunks_played % (sample_rate * CHANNELS / BUFFER_SIZE) == 0)
+    {
+      printf("\rqueued: %.1f / %.1f s  ",
+        (float)renderahead_queued(render_stream) / (sample_rate * CHANNELS),
+        (float)renderahead_capacity(render_stream) / (sample_rate * CHANNELS));
+      fflush(stdout);
+    }
+  }
+  if (verbose)
+    printf("\n");
+  gmeErr = renderahead_error(render_stream);
+  if (gmeErr)
+    printf("%s\n", gmeErr);
+
+  renderahead_stream_destroy(render_stream);
+  renderahead_pool_destroy(render_pool);
 
   snd_pcm_close(playback_handle);
 
   gme_free_info(info);
-  gme_delete(emu);
+  gamemusic_player_close(&player);
 
   return 0;
 }
-
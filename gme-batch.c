@@ -0,0 +1,684 @@
+/*
+ * Run a bulk job over a library of game music files in worker processes
+ *
+ * A malformed rip can crash or hang an emulator, so every file is handled
+ * by a separate worker process that the supervisor can lose without losing
+ * the run. A worker that crashes, or takes longer than the timeout on one
+ * file, is killed and replaced; the file is retried, and if it keeps
+ * failing it is quarantined: written to the quarantine list along with
+ * the reason, and skipped by later runs that use the same list.
+ *
+ * For each file, the workers write the gme2json output to "<file>.json"
+ * and, with -l, measure the loudness of every track like gme-loudness
+ * does and write "<file>.loudness".
+ *
+ * The manifest lists one file per line (blank lines and lines starting
+ * with '#' are ignored, as are the .json, .json.tmp and .loudness files
+ * this program writes), e.g. as made by:
+ *
+ *   find library -type f > library.manifest
+ *
+ * To split a job across several machines, run the same manifest on each
+ * with -s k/n; node k (1..n) takes every nth file starting with the kth.
+ *
+ * Each worker starts with an equal, contiguous share of the files. One
+ * that runs out of work takes the back half of the largest share left,
+ * so a worker stuck on a run of slow files doesn't hold up the others.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-batch.c gmejson.c gamemusic.c loudness.c \
+ *     -o gme-batch -lgme -lm
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "gmejson.h"
+#include "loudness.h"
+
+#define SAMPLE_RATE 44100
+#define DEFAULT_TIMEOUT 60
+#define DEFAULT_RETRIES 1
+#define DEFAULT_QUARANTINE "gme-batch.quarantine"
+#define JSON_EXTENSION ".json"
+#define TEMP_EXTENSION ".tmp"
+#define LINE_SIZE 4096
+
+typedef struct
+{
+  char *path;
+  int attempts;
+} job_t;
+
+/* what a worker sends back after each file */
+typedef struct
+{
+  int job;
+  int status;  /* 0 on success, else the exit code gme2json would give */
+} result_t;
+
+typedef struct
+{
+  pid_t pid;
+  int job_fd;       /* supervisor -> worker: job indexes */
+  int result_fd;    /* worker -> supervisor: result_t */
+  int head, tail;   /* this worker's share of the order array */
+  int job;          /* job being run, or -1 */
+  double deadline;
+  int completed;
+  int steals;
+} worker_t;
+
+static job_t *jobs;
+static int job_count;
+static worker_t *workers;
+static int worker_count;
+static int do_loudness = 0;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Strip the line ending; returns 0 for lines that hold no path */
+static int trim_line(char *line)
+{
+  size_t len = strlen(line);
+
+  while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    line[--len] = 0;
+  return len && line[0] != '#';
+}
+
+static int has_suffix(const char *path, const char *suffix)
+{
+  size_t len = strlen(path), suffix_len = strlen(suffix);
+
+  return len >= suffix_len && strcmp(&path[len - suffix_len], suffix) == 0;
+}
+
+/* Our own output, which a manifest made by find picks up on a second run */
+static int is_output_file(const char *path)
+{
+  return has_suffix(path, JSON_EXTENSION) ||
+    has_suffix(path, JSON_EXTENSION TEMP_EXTENSION) ||
+    has_suffix(path, LOUDNESS_EXTENSION);
+}
+
+/* Paths in the quarantine list are the part of each line before the tab */
+static int is_quarantined(char **quarantined, int count, const char *path)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    if (strcmp(quarantined[i], path) == 0)
+      return 1;
+  return 0;
+}
+
+static int load_manifest(const char *manifest, const char *quarantine,
+  int shard, int shard_count, int *skipped)
+{
+  char line[LINE_SIZE];
+  char **quarantined = NULL;
+  int quarantined_count = 0;
+  char *tab;
+  FILE *f;
+  int line_number = 0;
+
+  f = fopen(quarantine, "r");
+  if (f)
+  {
+    while (fgets(line, sizeof(line), f))
+    {
+      if (!trim_line(line))
+        continue;
+      tab = strchr(line, '\t');
+      if (tab)
+        *tab = 0;
+      quarantined = (char **)realloc(quarantined,
+        (quarantined_count + 1) * sizeof(char *));
+      if (!quarantined || !(quarantined[quarantined_count] = strdup(line)))
+      {
+        printf("failed to allocate memory\n");
+        return 3;
+      }
+      quarantined_count++;
+    }
+    fclose(f);
+  }
+
+  f = fopen(manifest, "r");
+  if (!f)
+  {
+    perror(manifest);
+    return 2;
+  }
+  while (fgets(line, sizeof(line), f))
+  {
+    if (!trim_line(line) || is_output_file(line))
+      continue;
+    /* shards are interleaved so that each node gets a similar mix */
+    if (line_number++ % shard_count != shard)
+      continue;
+    if (is_quarantined(quarantined, quarantined_count, line))
+    {
+      (*skipped)++;
+      continue;
+    }
+    jobs = (job_t *)realloc(jobs, (job_count + 1) * sizeof(job_t));
+    if (!jobs || !(jobs[job_count].path = strdup(line)))
+    {
+      printf("failed to allocate memory\n");
+      return 3;
+    }
+    jobs[job_count].attempts = 0;
+    job_count++;
+  }
+  fclose(f);
+
+  while (quarantined_count)
+    free(quarantined[--quarantined_count]);
+  free(quarantined);
+
+  return 0;
+}
+
+static int measure_loudness(const char *filename)
+{
+  gamemusic_player_t player;
+  loudness_t *results;
+  gme_info_t *info;
+  gme_err_t err;
+  int track_count, length;
+  int ret;
+  int i;
+
+  err = gamemusic_player_open(&player, filename, SAMPLE_RATE);
+  if (err)
+  {
+    printf("%s: %s\n", filename, err);
+    return 2;
+  }
+  track_count = gamemusic_player_track_count(&player);
+  results = (loudness_t *)malloc((track_count + 1) * sizeof(loudness_t));
+  if (!results)
+  {
+    gamemusic_player_close(&player);
+    return 3;
+  }
+
+  for (i = 0; i < track_count && !err; i++)
+  {
+    results[i].track = i;
+    err = gamemusic_player_track_info(&player, &info, i);
+    if (err)
+      break;
+    length = info->play_length;
+    gme_free_info(info);
+    err = gamemusic_player_start_track(&player, i);
+    if (!err)
+      err = loudness_analyze(player.emu, SAMPLE_RATE, length, &results[i]);
+  }
+
+  if (err)
+  {
+    printf("%s: track %d: %s\n", filename, i, err);
+    ret = 2;
+  }
+  else
+    ret = loudness_write_file(filename, results, track_count);
+  free(results);
+  gamemusic_player_close(&player);
+
+  return ret;
+}
+
+/* The JSON is written to a temporary file first so that a worker killed
+ * halfway through never leaves a truncated one behind */
+static char *temp_json_name(const char *filename)
+{
+  char *temp;
+
+  temp = (char *)malloc(strlen(filename) + strlen(JSON_EXTENSION) +
+    strlen(TEMP_EXTENSION) + 1);
+  if (temp)
+    sprintf(temp, "%s%s%s", filename, JSON_EXTENSION, TEMP_EXTENSION);
+  return temp;
+}
+
+static int run_job(const char *filename)
+{
+  char *json, *temp;
+  FILE *f;
+  int ret;
+
+  json = (char *)malloc(strlen(filename) + strlen(JSON_EXTENSION) + 1);
+  temp = temp_json_name(filename);
+  if (!json || !temp)
+    return 3;
+  sprintf(json, "%s%s", filename, JSON_EXTENSION);
+
+  /* the loudness goes first so that the JSON includes it */
+  ret = do_loudness ? measure_loudness(filename) : 0;
+
+  if (!ret)
+  {
+    f = fopen(temp, "w");
+    if (!f)
+    {
+      perror(temp);
+      ret = 2;
+    }
+    else
+    {
+      ret = gmejson_write(f, filename);
+      if (fclose(f) && !ret)
+        ret = 2;
+      if (ret || rename(temp, json))
+      {
+        if (!ret)
+          perror(json);
+        remove(temp);
+        ret = ret ? ret : 2;
+      }
+    }
+  }
+
+  free(json);
+  free(temp);
+
+  return ret;
+}
+
+static void worker_main(int job_fd, int result_fd)
+{
+  result_t result;
+  int job;
+
+  while (read(job_fd, &job, sizeof(job)) == sizeof(job))
+  {
+    result.job = job;
+    result.status = run_job(jobs[job].path);
+    fflush(stdout);
+    if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+      break;
+  }
+}
+
+static int spawn_worker(int index)
+{
+  worker_t *w = &workers[index];
+  int job_pipe[2], result_pipe[2];
+  int i;
+
+  if (pipe(job_pipe) < 0)
+  {
+    perror("pipe");
+    return 3;
+  }
+  if (pipe(result_pipe) < 0)
+  {
+    perror("pipe");
+    close(job_pipe[0]);
+    close(job_pipe[1]);
+    return 3;
+  }
+
+  /* nothing buffered in the supervisor should be printed twice */
+  fflush(stdout);
+  w->pid = fork();
+  if (w->pid < 0)
+  {
+    perror("fork");
+    close(job_pipe[0]);
+    close(job_pipe[1]);
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    return 3;
+  }
+
+  if (w->pid == 0)
+  {
+    /* only keep this worker's own ends, so that the supervisor sees EOF
+     * as soon as any one worker dies */
+    for (i = 0; i < worker_count; i++)
+    {
+      if (i == index || workers[i].pid <= 0)
+        continue;
+      close(workers[i].job_fd);
+      close(workers[i].result_fd);
+    }
+    close(job_pipe[1]);
+    close(result_pipe[0]);
+    worker_main(job_pipe[0], result_pipe[1]);
+    _exit(0);
+  }
+
+  close(job_pipe[0]);
+  close(result_pipe[1]);
+  w->job_fd = job_pipe[1];
+  w->result_fd = result_pipe[0];
+  w->job = -1;
+
+  return 0;
+}
+
+/* Kill a worker (if it's still running) and reap it; returns the wait
+ * status */
+static int reap_worker(worker_t *w, int kill_it)
+{
+  int status = 0;
+
+  if (kill_it)
+    kill(w->pid, SIGKILL);
+  close(w->job_fd);
+  close(w->result_fd);
+  while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  w->pid = 0;
+  w->job = -1;
+
+  return status;
+}
+
+/* Pick the next job for an idle worker: retries first, then its own
+ * share, then half of the largest share left. Returns -1 if none. */
+static int next_job(int *order, int index, int *retry, int *retry_head,
+  int retry_tail)
+{
+  worker_t *w = &workers[index];
+  int victim = -1, most = 0;
+  int i;
+
+  if (*retry_head < retry_tail)
+    return retry[(*retry_head)++];
+
+  if (w->head == w->tail)
+  {
+    for (i = 0; i < worker_count; i++)
+    {
+      if (workers[i].tail - workers[i].head > most)
+      {
+        most = workers[i].tail - workers[i].head;
+        victim = i;
+      }
+    }
+    if (victim < 0)
+      return -1;
+    w->head = workers[victim].head + most / 2;
+    w->tail = workers[victim].tail;
+    workers[victim].tail = w->head;
+    w->steals++;
+  }
+
+  return order[w->head++];
+}
+
+int main(int argc, char *argv[])
+{
+  const char *quarantine = DEFAULT_QUARANTINE;
+  struct pollfd *fds;
+  int *order, *retry, *polled;
+  int retry_head = 0, retry_tail = 0;
+  int timeout = DEFAULT_TIMEOUT, max_retries = DEFAULT_RETRIES;
+  int shard = 0, shard_count = 1;
+  int verbose = 0;
+  int skipped = 0, finished = 0, failed = 0, quarantined = 0, retried = 0;
+  int fd_count, busy, wait_ms;
+  int status, job, share, ret;
+  int opt;
+  int i;
+  double start_time, elapsed, earliest;
+  const char *reason;
+  char reason_buffer[64];
+  char *temp;
+  result_t result;
+  ssize_t got;
+  FILE *f;
+
+  worker_count = 0;
+  while ((opt = getopt(argc, argv, "w:t:r:s:q:lv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'w':
+        worker_count = atoi(optarg);
+        break;
+      case 't':
+        timeout = atoi(optarg);
+        break;
+      case 'r':
+        max_retries = atoi(optarg);
+        break;
+      case 's':
+        if (sscanf(optarg, "%d/%d", &shard, &shard_count) != 2 ||
+            shard_count < 1 || shard < 1 || shard > shard_count)
+          argc = 0;
+        shard--;
+        break;
+      case 'q':
+        quarantine = optarg;
+        break;
+      case 'l':
+        do_loudness = 1;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 1 || timeout < 1 || max_retries < 0)
+  {
+    printf("USAGE: gme-batch [-w workers] [-t timeout seconds] [-r retries] [-s k/n]\n"
+           "                 [-q quarantine file] [-l] [-v] <manifest>\n");
+    return 1;
+  }
+
+  ret = load_manifest(argv[optind], quarantine, shard, shard_count, &skipped);
+  if (ret)
+    return ret;
+  if (skipped)
+    printf("skipping %d quarantined files\n", skipped);
+
+  if (worker_count < 1)
+    worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (worker_count < 1)
+    worker_count = 1;
+  if (worker_count > job_count)
+    worker_count = job_count ? job_count : 1;
+
+  workers = (worker_t *)calloc(worker_count, sizeof(worker_t));
+  order = (int *)malloc((job_count + 1) * sizeof(int));
+  retry = (int *)malloc(((size_t)job_count * max_retries + 1) * sizeof(int));
+  fds = (struct pollfd *)malloc(worker_count * sizeof(struct pollfd));
+  polled = (int *)malloc(worker_count * sizeof(int));
+  if (!workers || !order || !retry || !fds || !polled)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+  for (i = 0; i < job_count; i++)
+    order[i] = i;
+
+  /* a worker dying while being sent a job shows up as EOF instead */
+  signal(SIGPIPE, SIG_IGN);
+
+  start_time = now();
+  for (i = 0; i < worker_count; i++)
+  {
+    share = job_count / worker_count + (i < job_count % worker_count);
+    workers[i].head = i ? workers[i - 1].tail : 0;
+    workers[i].tail = workers[i].head + share;
+    if (spawn_worker(i))
+      return 3;
+  }
+
+  while (finished < job_count)
+  {
+    /* hand out work to every idle worker */
+    for (i = 0; i < worker_count; i++)
+    {
+      if (workers[i].job >= 0)
+        continue;
+      job = next_job(order, i, retry, &retry_head, retry_tail);
+      if (job < 0)
+        break;
+      jobs[job].attempts++;
+      workers[i].job = job;
+      workers[i].deadline = now() + timeout;
+      /* if the write fails the worker is gone; poll() will say so */
+      if (write(workers[i].job_fd, &job, sizeof(job)) != sizeof(job))
+        workers[i].deadline = now();
+    }
+
+    busy = 0;
+    fd_count = 0;
+    earliest = 0.0;
+    for (i = 0; i < worker_count; i++)
+    {
+      if (workers[i].job < 0)
+        continue;
+      if (!busy++ || workers[i].deadline < earliest)
+        earliest = workers[i].deadline;
+      fds[fd_count].fd = workers[i].result_fd;
+      fds[fd_count].events = POLLIN;
+      fds[fd_count].revents = 0;
+      polled[fd_count++] = i;
+    }
+    if (!busy)
+      break;  /* shouldn't happen: every unfinished job is queued */
+
+    wait_ms = (int)((earliest - now()) * 1000.0) + 1;
+    if (wait_ms < 0)
+      wait_ms = 0;
+    if (poll(fds, fd_count, wait_ms) < 0 && errno != EINTR)
+    {
+      perror("poll");
+      break;
+    }
+
+    for (i = 0; i < fd_count; i++)
+    {
+      worker_t *w = &workers[polled[i]];
+
+      reason = NULL;
+      job = w->job;
+      if (fds[i].revents)
+      {
+        got = read(w->result_fd, &result, sizeof(result));
+        if (got == sizeof(result) && result.job == job)
+        {
+          w->job = -1;
+          w->completed++;
+          finished++;
+          if (result.status)
+          {
+            printf("%s: failed\n", jobs[job].path);
+            failed++;
+          }
+          else if (verbose)
+            printf("%s: done\n", jobs[job].path);
+          continue;
+        }
+
+        /* EOF (or garbage): the worker died */
+        status = reap_worker(w, 1);
+        if (WIFSIGNALED(status))
+        {
+          snprintf(reason_buffer, sizeof(reason_buffer), "crashed (%s)",
+            strsignal(WTERMSIG(status)));
+          reason = reason_buffer;
+        }
+        else
+          reason = "worker exited";
+      }
+      else if (now() >= w->deadline)
+      {
+        reap_worker(w, 1);
+        reason = "timed out";
+      }
+      else
+        continue;
+
+      temp = temp_json_name(jobs[job].path);
+      if (temp)
+        remove(temp);
+      free(temp);
+
+      if (jobs[job].attempts <= max_retries)
+      {
+        printf("%s: %s, retrying\n", jobs[job].path, reason);
+        retry[retry_tail++] = job;
+        retried++;
+      }
+      else
+      {
+        printf("%s: %s, quarantined\n", jobs[job].path, reason);
+        f = fopen(quarantine, "a");
+        if (f)
+        {
+          fprintf(f, "%s\t%s\n", jobs[job].path, reason);
+          fclose(f);
+        }
+        else
+          perror(quarantine);
+        quarantined++;
+        finished++;
+      }
+
+      if (spawn_worker(polled[i]))
+      {
+        finished = job_count;  /* give up; the others are reaped below */
+        failed++;
+        break;
+      }
+    }
+  }
+  elapsed = now() - start_time;
+
+  /* closing the job pipes tells the workers to exit */
+  for (i = 0; i < worker_count; i++)
+  {
+    if (workers[i].pid > 0)
+      reap_worker(&workers[i], workers[i].job >= 0);
+    if (verbose)
+      printf("worker %d: %d files, %d steals\n", i, workers[i].completed,
+        workers[i].steals);
+  }
+
+  printf("%d files in %.1f s on %d workers", job_count, elapsed,
+    worker_count);
+  if (elapsed > 0.0)
+    printf(" (%.1f files/s)", job_count / elapsed);
+  printf(": %d failed, %d quarantined, %d retries\n", failed, quarantined,
+    retried);
+
+  for (i = 0; i < job_count; i++)
+    free(jobs[i].path);
+  free(jobs);
+  free(workers);
+  free(order);
+  free(retry);
+  free(fds);
+  free(polled);
+
+  return (failed || quarantined) ? 2 : 0;
+}
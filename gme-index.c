@@ -0,0 +1,445 @@
+/*
+ * Build a searchable metadata index for a library of game music files
+ *
+ * Every track of every file given on the command line (directories are
+ * searched recursively, and .gamemusic containers contribute one track per
+ * entry) is recorded in a single index file that gme-query can search
+ * without opening any music file. See gmeindex.h for the format.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-index.c gamemusic.c gmeindex.c -o gme-index -lgme
+ */
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <unistd.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "gmeindex.h"
+
+#define DEFAULT_INDEX_FILE "library.gmeindex"
+#define MAX_OPEN_DIRS 32
+#define TEMP_EXTENSION ".tmp"
+
+typedef struct
+{
+  unsigned int token;  /* string offset */
+  unsigned int track;
+} posting_t;
+
+/* everything is accumulated here, then written out in one go */
+static char *strings;
+static size_t strings_size, strings_alloc;
+static unsigned int *string_hash;
+static size_t string_hash_size, string_hash_used;
+
+static unsigned int *files;
+static unsigned int file_count;
+static size_t file_alloc;
+
+static unsigned int *tracks;
+static unsigned int track_count;
+static size_t track_alloc;  /* in words */
+
+static posting_t *postings;
+static size_t posting_count, posting_alloc;
+
+static int verbose = 0;
+static int skipped = 0;
+static int failed = 0;
+
+static void *grow(void *array, size_t *alloc, size_t needed, size_t size)
+{
+  if (needed <= *alloc)
+    return array;
+  *alloc = (*alloc < 1024) ? 1024 : *alloc;
+  while (*alloc < needed)
+    *alloc *= 2;
+  array = realloc(array, *alloc * size);
+  if (!array)
+  {
+    printf("failed to allocate memory\n");
+    exit(3);
+  }
+  return array;
+}
+
+static unsigned int hash_string(const char *str)
+{
+  unsigned int hash = 2166136261u;  /* FNV-1a */
+
+  while (*str)
+    hash = (hash ^ (unsigned char)*str++) * 16777619u;
+  return hash;
+}
+
+/* Store a string in the pool (once) and return its offset */
+static unsigned int add_string(const char *str)
+{
+  unsigned int *old_hash;
+  size_t old_size, i, slot, len;
+
+  if (!str)
+    str = "";
+
+  /* keep the hash table no more than half full */
+  if ((string_hash_used + 1) * 2 > string_hash_size)
+  {
+    old_hash = string_hash;
+    old_size = string_hash_size;
+    string_hash_size = old_size ? old_size * 2 : 4096;
+    string_hash = (unsigned int *)malloc(string_hash_size * sizeof(unsigned int));
+    if (!string_hash)
+    {
+      printf("failed to allocate memory\n");
+      exit(3);
+    }
+    /* slots hold offset + 1 so that 0 means empty */
+    memset(string_hash, 0, string_hash_size * sizeof(unsigned int));
+    for (i = 0; i < old_size; i++)
+    {
+      if (!old_hash[i])
+        continue;
+      slot = hash_string(&strings[old_hash[i] - 1]) & (string_hash_size - 1);
+      while (string_hash[slot])
+        slot = (slot + 1) & (string_hash_size - 1);
+      string_hash[slot] = old_hash[i];
+    }
+    free(old_hash);
+  }
+
+  slot = hash_string(str) & (string_hash_size - 1);
+  while (string_hash[slot])
+  {
+    if (strcmp(&strings[string_hash[slot] - 1], str) == 0)
+      return string_hash[slot] - 1;
+    slot = (slot + 1) & (string_hash_size - 1);
+  }
+
+  len = strlen(str) + 1;
+  strings = (char *)grow(strings, &strings_alloc, strings_size + len, 1);
+  memcpy(&strings[strings_size], str, len);
+  string_hash[slot] = strings_size + 1;
+  string_hash_used++;
+  strings_size += len;
+
+  return string_hash[slot] - 1;
+}
+
+typedef struct
+{
+  const char *field;
+  unsigned int track;
+} token_context_t;
+
+static void add_token(const char *word, void *context)
+{
+  token_context_t *tc = (token_context_t *)context;
+  char token[GMEINDEX_MAX_TOKEN * 2];
+
+  snprintf(token, sizeof(token), "%s:%s", tc->field, word);
+  postings = (posting_t *)grow(postings, &posting_alloc, posting_count + 1,
+    sizeof(posting_t));
+  postings[posting_count].token = add_string(token);
+  postings[posting_count].track = tc->track;
+  posting_count++;
+}
+
+static void add_track(unsigned int file, int number, gme_info_t *info,
+  const char *type)
+{
+  token_context_t tc;
+  const char *values[GMEINDEX_FIELD_COUNT];
+  unsigned int *t;
+  int i;
+
+  tracks = (unsigned int *)grow(tracks, &track_alloc,
+    (size_t)(track_count + 1) * GMEINDEX_TRACK_WORDS, sizeof(unsigned int));
+  t = &tracks[track_count * GMEINDEX_TRACK_WORDS];
+
+  values[0] = info->system;
+  values[1] = info->game;
+  values[2] = info->song;
+  values[3] = info->author;
+  values[4] = info->copyright;
+  values[5] = info->dumper;
+  values[6] = type;
+
+  t[GMEINDEX_TRACK_FILE] = file;
+  t[GMEINDEX_TRACK_NUMBER] = number;
+  for (i = 0; i < GMEINDEX_FIELD_COUNT; i++)
+  {
+    t[gmeindex_field_words[i]] = add_string(values[i]);
+    tc.field = gmeindex_field_names[i];
+    tc.track = track_count;
+    gmeindex_tokenize(values[i] ? values[i] : "", add_token, &tc);
+  }
+  t[GMEINDEX_TRACK_LENGTH] = info->length;
+  t[GMEINDEX_TRACK_INTRO_LENGTH] = info->intro_length;
+  t[GMEINDEX_TRACK_LOOP_LENGTH] = info->loop_length;
+  t[GMEINDEX_TRACK_PLAY_LENGTH] = info->play_length;
+
+  track_count++;
+}
+
+static void index_file(const char *filename)
+{
+  gamemusic_player_t player;
+  const unsigned char *entry;
+  unsigned char header[4];
+  size_t entry_size;
+  const char *type = "";
+  gme_info_t *info;
+  gme_err_t err;
+  FILE *f;
+  int count, i;
+  int unreadable = 0;
+
+  err = gamemusic_player_open(&player, filename, gme_info_only);
+  if (err == gme_wrong_file_type)
+  {
+    /* not game music (a cover image, a text file...); that's expected */
+    if (verbose)
+      printf("%s: skipping (%s)\n", filename, err);
+    skipped++;
+    return;
+  }
+  if (err)
+  {
+    /* something GME should have read but couldn't is always reported */
+    printf("%s: %s\n", filename, err);
+    failed++;
+    return;
+  }
+
+  /* the file type comes from the data itself, as GME would detect it */
+  if (!player.is_container)
+  {
+    f = fopen(filename, "rb");
+    if (f && fread(header, sizeof(header), 1, f) == 1)
+      type = gme_identify_header(header);
+    if (f)
+      fclose(f);
+  }
+
+  files = (unsigned int *)grow(files, &file_alloc, file_count + 1,
+    sizeof(unsigned int));
+  files[file_count] = add_string(filename);
+
+  count = gamemusic_player_track_count(&player);
+  for (i = 0; i < count; i++)
+  {
+    if (player.is_container)
+    {
+      type = "";
+      if (!gamemusic_entry(&player.container, i, &entry, &entry_size) &&
+          entry_size >= 4)
+        type = gme_identify_header(entry);
+    }
+    err = gamemusic_player_track_info(&player, &info, i);
+    if (err)
+    {
+      printf("%s: track %d: %s\n", filename, i, err);
+      unreadable = 1;
+      continue;
+    }
+    add_track(file_count, i, info, type);
+    gme_free_info(info);
+  }
+  file_count++;
+  /* the other tracks are indexed, but the file still counts as failed */
+  if (unreadable)
+    failed++;
+
+  if (verbose)
+    printf("%s: %d tracks\n", filename, count);
+
+  gamemusic_player_close(&player);
+}
+
+static int index_tree_entry(const char *path, const struct stat *st,
+  int flag, struct FTW *ftw)
+{
+  if (flag == FTW_F)
+    index_file(path);
+  return 0;
+}
+
+static int compare_postings(const void *a, const void *b)
+{
+  const posting_t *pa = (const posting_t *)a;
+  const posting_t *pb = (const posting_t *)b;
+  int cmp;
+
+  cmp = strcmp(&strings[pa->token], &strings[pb->token]);
+  if (cmp)
+    return cmp;
+  return (pa->track > pb->track) - (pa->track < pb->track);
+}
+
+static void put_le32(FILE *f, unsigned int value)
+{
+  putc(value & 0xFF, f);
+  putc((value >> 8) & 0xFF, f);
+  putc((value >> 16) & 0xFF, f);
+  putc((value >> 24) & 0xFF, f);
+}
+
+static int write_index(const char *filename)
+{
+  unsigned int token_count = 0, unique_postings = 0;
+  unsigned int file_off, track_off, token_off, postings_off, strings_off;
+  size_t i, j;
+  char *temp;
+  FILE *f;
+  int error;
+
+  /* sort by token, then track, and drop repeats (a word that appears
+   * twice in one field, say) */
+  qsort(postings, posting_count, sizeof(posting_t), compare_postings);
+  for (i = 0; i < posting_count; i++)
+  {
+    if (i && postings[i].token == postings[unique_postings - 1].token &&
+        postings[i].track == postings[unique_postings - 1].track)
+      continue;
+    if (!i || postings[i].token != postings[unique_postings - 1].token)
+      token_count++;
+    postings[unique_postings++] = postings[i];
+  }
+
+  file_off = GMEINDEX_HEADER_SIZE;
+  track_off = file_off + file_count * 4;
+  token_off = track_off + track_count * GMEINDEX_TRACK_SIZE;
+  postings_off = token_off + token_count * GMEINDEX_TOKEN_SIZE;
+  strings_off = postings_off + unique_postings * 4;
+
+  /* gme-query maps the index, so it's written to a temporary file and
+   * renamed over the old one rather than being rewritten under a reader */
+  temp = (char *)malloc(strlen(filename) + strlen(TEMP_EXTENSION) + 1);
+  if (!temp)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+  sprintf(temp, "%s%s", filename, TEMP_EXTENSION);
+  f = fopen(temp, "wb");
+  if (!f)
+  {
+    perror(temp);
+    free(temp);
+    return 2;
+  }
+
+  fwrite(GMEINDEX_SIGNATURE, GMEINDEX_SIGNATURE_SIZE, 1, f);
+  put_le32(f, GMEINDEX_VERSION);
+  put_le32(f, file_count);
+  put_le32(f, file_off);
+  put_le32(f, track_count);
+  put_le32(f, track_off);
+  put_le32(f, token_count);
+  put_le32(f, token_off);
+  put_le32(f, postings_off);
+  put_le32(f, strings_off);
+  put_le32(f, strings_size);
+
+  for (i = 0; i < file_count; i++)
+    put_le32(f, files[i]);
+  for (i = 0; i < (size_t)track_count * GMEINDEX_TRACK_WORDS; i++)
+    put_le32(f, tracks[i]);
+
+  /* one token record per run of equal tokens */
+  for (i = 0; i < unique_postings; i = j)
+  {
+    for (j = i + 1; j < unique_postings && postings[j].token == postings[i].token; j++)
+      ;
+    put_le32(f, postings[i].token);
+    put_le32(f, i);
+    put_le32(f, j - i);
+  }
+  for (i = 0; i < unique_postings; i++)
+    put_le32(f, postings[i].track);
+
+  fwrite(strings, strings_size, 1, f);
+
+  error = ferror(f);
+  if (fclose(f) || error)
+  {
+    perror(temp);
+    remove(temp);
+    free(temp);
+    return 2;
+  }
+  if (rename(temp, filename))
+  {
+    perror(filename);
+    remove(temp);
+    free(temp);
+    return 2;
+  }
+  free(temp);
+
+  printf("indexed %u tracks from %u files (%u tokens) into %s\n",
+    track_count, file_count, token_count, filename);
+  if (skipped)
+    printf("skipped %d files that are not game music\n", skipped);
+  if (failed)
+  {
+    printf("failed to read %d files; what couldn't be read is not in the index\n",
+      failed);
+    return 2;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *output = DEFAULT_INDEX_FILE;
+  struct stat st;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "o:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'o':
+        output = optarg;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 1)
+  {
+    printf("USAGE: gme-index [-o index file] [-v] <file or directory> [...]\n");
+    return 1;
+  }
+
+  /* offset 0 is the empty string, used for missing fields */
+  add_string("");
+
+  for (i = optind; i < argc; i++)
+  {
+    if (stat(argv[i], &st) < 0)
+    {
+      perror(argv[i]);
+      continue;
+    }
+    if (S_ISDIR(st.st_mode))
+      nftw(argv[i], index_tree_entry, MAX_OPEN_DIRS, FTW_PHYS);
+    else
+      index_file(argv[i]);
+  }
+
+  return write_index(output);
+}
@@ -0,0 +1,203 @@
+/*
+ * Measure the loudness of every track in a set of game music files
+ *
+ * Each track is emulated on its own, so the tracks are spread across all
+ * CPUs. The results go into a "<file>.loudness" sidecar next to each file,
+ * where gme2json and the players pick them up.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-loudness.c gamemusic.c loudness.c parallel.c \
+ *     -o gme-loudness -lgme -lm -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "loudness.h"
+#include "parallel.h"
+
+#define SAMPLE_RATE 44100
+
+typedef struct
+{
+  const char *filename;
+  int is_container;
+  loudness_t result;
+  int length;
+  gme_err_t err;
+} analysis_job_t;
+
+static void analyze_track(int index, void *context)
+{
+  analysis_job_t *job = &((analysis_job_t *)context)[index];
+  gamemusic_t gm;
+  Music_Emu *emu;
+  gme_info_t *info;
+  int track = job->result.track;
+
+  /* every job gets its own emulator; for a container that's just the one
+   * entry, played from its own mapping of the file */
+  if (job->is_container)
+  {
+    if (gamemusic_open(&gm, job->filename))
+    {
+      job->err = "Couldn't open .gamemusic container";
+      return;
+    }
+    job->err = gamemusic_open_emu(&gm, track, &emu, SAMPLE_RATE);
+    track = 0;
+  }
+  else
+    job->err = gme_open_file(job->filename, &emu, SAMPLE_RATE);
+
+  if (!job->err)
+  {
+    job->err = gme_track_info(emu, &info, track);
+    if (!job->err)
+    {
+      job->length = info->play_length;
+      gme_free_info(info);
+      job->err = gme_start_track(emu, track);
+    }
+    if (!job->err)
+      job->err = loudness_analyze(emu, SAMPLE_RATE, job->length,
+        &job->result);
+    gme_delete(emu);
+  }
+  if (job->is_container)
+    gamemusic_close(&gm);
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+  analysis_job_t *jobs = NULL;
+  loudness_t *results;
+  gamemusic_player_t player;
+  gme_err_t err;
+  int job_count = 0;
+  int thread_count = 0;
+  int track_count, is_container;
+  int first, count, measured;
+  int failed = 0;
+  int opt;
+  int i, j;
+  double start_time, elapsed, audio_seconds = 0.0;
+
+  while ((opt = getopt(argc, argv, "j:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        thread_count = atoi(optarg);
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 1)
+  {
+    printf("USAGE: gme-loudness [-j threads] <game music file> [...]\n");
+    return 1;
+  }
+
+  /* one job per track of every file */
+  for (i = optind; i < argc; i++)
+  {
+    err = gamemusic_player_open(&player, argv[i], gme_info_only);
+    if (err)
+    {
+      printf("%s: %s\n", argv[i], err);
+      failed = 1;
+      continue;
+    }
+    track_count = gamemusic_player_track_count(&player);
+    is_container = player.is_container;
+    gamemusic_player_close(&player);
+
+    jobs = (analysis_job_t *)realloc(jobs,
+      (job_count + track_count) * sizeof(analysis_job_t));
+    if (!jobs)
+    {
+      printf("failed to allocate memory\n");
+      return 3;
+    }
+    for (j = 0; j < track_count; j++)
+    {
+      jobs[job_count].filename = argv[i];
+      jobs[job_count].is_container = is_container;
+      jobs[job_count].result.track = j;
+      jobs[job_count].length = 0;
+      jobs[job_count].err = NULL;
+      job_count++;
+    }
+  }
+
+  if (thread_count < 1)
+    thread_count = parallel_cpu_count();
+  start_time = now();
+  parallel_run(thread_count, job_count, analyze_track, jobs);
+  elapsed = now() - start_time;
+
+  /* jobs for one file are contiguous; gather each file's results */
+  results = (loudness_t *)malloc((job_count + 1) * sizeof(loudness_t));
+  if (!results)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+  for (first = 0; first < job_count; first += j)
+  {
+    count = 0;
+    measured = 0;
+    for (j = 0; first + j < job_count &&
+      jobs[first + j].filename == jobs[first].filename; j++)
+    {
+      if (jobs[first + j].err)
+      {
+        printf("%s: track %d: %s\n", jobs[first + j].filename,
+          jobs[first + j].result.track, jobs[first + j].err);
+        failed = 1;
+        /* keep what an earlier run measured for this track, if anything */
+        if (!loudness_read_track(jobs[first].filename,
+            jobs[first + j].result.track, &results[count]))
+          count++;
+        continue;
+      }
+      measured++;
+      results[count++] = jobs[first + j].result;
+      audio_seconds += jobs[first + j].length / 1000.0;
+      printf("%s: track %d: %.1f LUFS, peak %.3f, gain %+.1f dB\n",
+        jobs[first + j].filename, jobs[first + j].result.track,
+        jobs[first + j].result.loudness, jobs[first + j].result.peak,
+        jobs[first + j].result.gain);
+    }
+    /* a file where nothing could be measured keeps its old sidecar */
+    if (measured && loudness_write_file(jobs[first].filename, results, count))
+      failed = 1;
+  }
+
+  printf("analyzed %d tracks (%.0f s of audio) in %.1f s on %d threads",
+    job_count, audio_seconds, elapsed, thread_count);
+  if (elapsed > 0.0)
+    printf(", %.1fx realtime", audio_seconds / elapsed);
+  printf("\n");
+
+  free(results);
+  free(jobs);
+
+  return failed ? 2 : 0;
+}
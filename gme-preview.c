@@ -0,0 +1,320 @@
+/*
+ * Make a short preview clip of every track in a set of game music files
+ *
+ * Each clip is PREVIEW_LENGTH seconds long, starts where the track's intro
+ * ends (when the file says where that is), fades in and out, and is
+ * written as "<output directory>/<file name>-NN.wav" (so a second file
+ * with the same name in another directory is skipped). If gme-loudness has
+ * analyzed a file, its clips are brought to a common level too; -n turns
+ * this off.
+ *
+ * Getting to the start of a clip means emulating everything before it
+ * (gme_seek() runs the emulator forward), which often costs more than the
+ * clip itself. Every track of a file is handled by one job that reuses the
+ * file's emulator (each entry of a .gamemusic container is a separate
+ * music file, so there the job opens one emulator per entry). The jobs are
+ * sorted by the amount of audio they have to emulate, seeks included, so
+ * the most expensive files start first and the cheap ones fill in the gaps
+ * at the end.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-preview.c gamemusic.c loudness.c parallel.c wav.c \
+ *     -o gme-preview -lgme -lm -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "loudness.h"
+#include "parallel.h"
+#include "wav.h"
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define PREVIEW_LENGTH 15
+#define FADE_IN_MS 500
+#define FADE_OUT_MS 2000
+#define CLIP_SAMPLES (PREVIEW_LENGTH * SAMPLE_RATE * CHANNELS)
+
+typedef struct
+{
+  const char *filename;
+  int track_count;
+  int *starts;          /* where each track's clip starts, in ms */
+  long long cost;       /* ms of audio to emulate, seeks included */
+  int clips;
+  gme_err_t err;
+} preview_job_t;
+
+typedef struct
+{
+  preview_job_t *jobs;
+  const char *output_dir;
+  int normalize;
+} preview_context_t;
+
+static const char *base_name(const char *filename)
+{
+  const char *base = strrchr(filename, '/');
+
+  return base ? base + 1 : filename;
+}
+
+/* Pick where a track's clip starts: after the intro, but not so late that
+ * the clip would run past the end of the track */
+static int clip_start(const gme_info_t *info)
+{
+  int start = info->intro_length > 0 ? info->intro_length : 0;
+
+  if (info->length > 0 && start + PREVIEW_LENGTH * 1000 > info->length)
+    start = info->length - PREVIEW_LENGTH * 1000;
+  return start > 0 ? start : 0;
+}
+
+/* Linear fades, applied in place to interleaved stereo */
+static void fade_clip(short *samples)
+{
+  int fade_in = FADE_IN_MS * SAMPLE_RATE / 1000;
+  int fade_out = FADE_OUT_MS * SAMPLE_RATE / 1000;
+  int frames = CLIP_SAMPLES / CHANNELS;
+  short *end = &samples[(frames - 1) * CHANNELS];
+  int i;
+
+  for (i = 0; i < fade_in; i++)
+  {
+    samples[i * 2 + 0] = (long long)samples[i * 2 + 0] * i / fade_in;
+    samples[i * 2 + 1] = (long long)samples[i * 2 + 1] * i / fade_in;
+  }
+  for (i = 0; i < fade_out; i++)
+  {
+    end[-i * 2 + 0] = (long long)end[-i * 2 + 0] * i / fade_out;
+    end[-i * 2 + 1] = (long long)end[-i * 2 + 1] * i / fade_out;
+  }
+}
+
+static void make_previews(int index, void *context)
+{
+  preview_context_t *pc = (preview_context_t *)context;
+  preview_job_t *job = &pc->jobs[index];
+  gamemusic_player_t player;
+  loudness_t loudness;
+  char *output;
+  short *clip;
+  FILE *f;
+  int i;
+
+  clip = (short *)malloc(CLIP_SAMPLES * sizeof(short));
+  output = (char *)malloc(strlen(pc->output_dir) + strlen(job->filename) + 16);
+  if (!clip || !output)
+  {
+    job->err = "failed to allocate memory";
+    free(clip);
+    free(output);
+    return;
+  }
+
+  /* the same emulator plays every track; only containers swap it out */
+  job->err = gamemusic_player_open(&player, job->filename, SAMPLE_RATE);
+  if (job->err)
+  {
+    free(clip);
+    free(output);
+    return;
+  }
+  for (i = 0; i < job->track_count; i++)
+  {
+    job->err = gamemusic_player_start_track(&player, i);
+    if (!job->err && job->starts[i])
+      job->err = gme_seek(player.emu, job->starts[i]);
+    if (!job->err)
+      job->err = gme_play(player.emu, CLIP_SAMPLES, clip);
+    if (job->err)
+      break;
+
+    if (pc->normalize && !loudness_read_track(job->filename, i, &loudness))
+      loudness_apply_gain(clip, CLIP_SAMPLES,
+        loudness_gain_to_fixed(loudness.gain));
+    fade_clip(clip);
+
+    sprintf(output, "%s/%s-%02d.wav", pc->output_dir,
+      base_name(job->filename), i + 1);
+    f = wav_open(output, SAMPLE_RATE, CHANNELS);
+    if (!f)
+    {
+      job->err = "failed to create clip";
+      break;
+    }
+    if (wav_write(f, clip, CLIP_SAMPLES) | wav_close(f))
+    {
+      job->err = "failed to write clip";
+      break;
+    }
+    job->clips++;
+  }
+  gamemusic_player_close(&player);
+
+  free(clip);
+  free(output);
+}
+
+/* Most expensive first */
+static int compare_cost(const void *a, const void *b)
+{
+  const preview_job_t *ja = (const preview_job_t *)a;
+  const preview_job_t *jb = (const preview_job_t *)b;
+
+  return (jb->cost > ja->cost) - (jb->cost < ja->cost);
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+  preview_context_t pc;
+  preview_job_t *jobs;
+  gamemusic_player_t player;
+  gme_info_t *info;
+  gme_err_t err;
+  int job_count = 0;
+  int thread_count = 0;
+  int clip_count = 0;
+  int failed = 0;
+  int opt;
+  int i, j;
+  double start_time, elapsed, emulated = 0.0;
+
+  pc.output_dir = ".";
+  pc.normalize = 1;
+  while ((opt = getopt(argc, argv, "j:o:n")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        thread_count = atoi(optarg);
+        break;
+      case 'o':
+        pc.output_dir = optarg;
+        break;
+      case 'n':
+        pc.normalize = 0;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 1)
+  {
+    printf("USAGE: gme-preview [-j threads] [-o output directory] [-n] <game music file> [...]\n");
+    return 1;
+  }
+
+  jobs = (preview_job_t *)calloc(argc - optind, sizeof(preview_job_t));
+  if (!jobs)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+
+  /* plan every clip from the metadata alone, to know what each file costs */
+  for (i = optind; i < argc; i++)
+  {
+    preview_job_t *job = &jobs[job_count];
+
+    /* clips are named after the file alone, so two files with the same
+     * name would write over each other's clips */
+    for (j = 0; j < job_count; j++)
+      if (strcmp(base_name(jobs[j].filename), base_name(argv[i])) == 0)
+        break;
+    if (j < job_count)
+    {
+      printf("%s: same file name as %s; skipping\n", argv[i],
+        jobs[j].filename);
+      failed = 1;
+      continue;
+    }
+
+    err = gamemusic_player_open(&player, argv[i], gme_info_only);
+    if (err)
+    {
+      printf("%s: %s\n", argv[i], err);
+      failed = 1;
+      continue;
+    }
+    job->filename = argv[i];
+    job->track_count = gamemusic_player_track_count(&player);
+    job->starts = (int *)calloc(job->track_count + 1, sizeof(int));
+    if (!job->starts)
+    {
+      printf("failed to allocate memory\n");
+      return 3;
+    }
+    for (j = 0; j < job->track_count; j++)
+    {
+      err = gamemusic_player_track_info(&player, &info, j);
+      if (err)
+      {
+        printf("%s: track %d: %s\n", argv[i], j + 1, err);
+        break;
+      }
+      job->starts[j] = clip_start(info);
+      job->cost += job->starts[j] + PREVIEW_LENGTH * 1000;
+      gme_free_info(info);
+    }
+    gamemusic_player_close(&player);
+    if (err)
+    {
+      /* a track we can't read would fail the same way during the job */
+      failed = 1;
+      free(job->starts);
+      memset(job, 0, sizeof(preview_job_t));
+      continue;
+    }
+    emulated += job->cost / 1000.0;
+    job_count++;
+  }
+
+  qsort(jobs, job_count, sizeof(preview_job_t), compare_cost);
+
+  if (thread_count < 1)
+    thread_count = parallel_cpu_count();
+  pc.jobs = jobs;
+  start_time = now();
+  parallel_run(thread_count, job_count, make_previews, &pc);
+  elapsed = now() - start_time;
+
+  for (i = 0; i < job_count; i++)
+  {
+    if (jobs[i].err)
+    {
+      printf("%s: track %d: %s\n", jobs[i].filename, jobs[i].clips + 1,
+        jobs[i].err);
+      failed = 1;
+    }
+    clip_count += jobs[i].clips;
+    free(jobs[i].starts);
+  }
+
+  printf("made %d clips from %d files in %.1f s on %d threads", clip_count,
+    job_count, elapsed, thread_count);
+  if (elapsed > 0.0)
+    printf(", %.1f clips/s (%.1fx realtime, seeks included)",
+      clip_count / elapsed, emulated / elapsed);
+  printf("\n");
+
+  free(jobs);
+
+  return failed ? 2 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Search a metadata index built by gme-index
+ *
+ * Each search term is a word, optionally limited to one field and
+ * optionally ending in '*' to match any word with that prefix; a track
+ * must match every term. A term made of several words ("game:super-mario")
+ * needs all of them to match. For example:
+ *
+ *   gme-query library.gmeindex author:hubbard
+ *   gme-query library.gmeindex type:spc game:zel*
+ *
+ * The fields are system, game, song, author, copyright, dumper and type
+ * (the file type as detected by GME, e.g. spc or nsf), in any case; any
+ * other field name is an error.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-query.c gmeindex.c -o gme-query
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "gmeindex.h"
+
+typedef struct
+{
+  const gmeindex_t *index;
+  const char *field;  /* NULL for any field */
+  int prefix;
+  const char *last_word;
+  unsigned char *matches;
+  unsigned char *word_matches;
+  size_t bitmap_size;
+  int words;
+} term_context_t;
+
+/* Narrow the matches down to the tracks having this word */
+static void match_word(const char *word, void *context)
+{
+  term_context_t *tc = (term_context_t *)context;
+  char key[GMEINDEX_MAX_TOKEN * 2];
+  size_t j;
+  int i;
+
+  memset(tc->word_matches, 0, tc->bitmap_size);
+  for (i = 0; i < GMEINDEX_FIELD_COUNT; i++)
+  {
+    if (tc->field && strcmp(tc->field, gmeindex_field_names[i]) != 0)
+      continue;
+    snprintf(key, sizeof(key), "%s:%s", gmeindex_field_names[i], word);
+    /* only the last word of a term can be a prefix */
+    gmeindex_match(tc->index, key,
+      tc->prefix && strcmp(word, tc->last_word) == 0, tc->word_matches);
+  }
+
+  for (j = 0; j < tc->bitmap_size; j++)
+    tc->matches[j] &= tc->word_matches[j];
+  tc->words++;
+}
+
+/* Look a field name up, in any case; NULL if there's no such field */
+static const char *find_field(const char *name)
+{
+  int i;
+
+  for (i = 0; i < GMEINDEX_FIELD_COUNT; i++)
+    if (strcasecmp(name, gmeindex_field_names[i]) == 0)
+      return gmeindex_field_names[i];
+  return NULL;
+}
+
+/* Find the last word of a term, as the tokenizer will see it */
+static void remember_word(const char *word, void *context)
+{
+  snprintf((char *)context, GMEINDEX_MAX_TOKEN, "%s", word);
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+  gmeindex_t index;
+  term_context_t tc;
+  unsigned char *matches, *word_matches;
+  char term[GMEINDEX_MAX_TOKEN * 2];
+  char last_word[GMEINDEX_MAX_TOKEN];
+  char *word;
+  size_t bitmap_size, len;
+  unsigned int track;
+  int count_only = 0;
+  int match_count = 0;
+  int opt;
+  int i, j;
+  double start_time;
+
+  while ((opt = getopt(argc, argv, "c")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        count_only = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 2)
+  {
+    printf("USAGE: gme-query [-c] <index file> [field:]word[*] [...]\n");
+    return 1;
+  }
+
+  start_time = now();
+  if (gmeindex_open(&index, argv[optind]))
+    return 2;
+
+  /* one bit per track; start with everything and narrow it down */
+  bitmap_size = (index.track_count + 7) / 8 + 1;
+  matches = (unsigned char *)malloc(bitmap_size);
+  word_matches = (unsigned char *)malloc(bitmap_size);
+  if (!matches || !word_matches)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+  memset(matches, 0xFF, bitmap_size);
+
+  for (i = optind + 1; i < argc; i++)
+  {
+    snprintf(term, sizeof(term), "%s", argv[i]);
+
+    tc.index = &index;
+    tc.field = NULL;
+    tc.prefix = 0;
+    tc.matches = matches;
+    tc.word_matches = word_matches;
+    tc.bitmap_size = bitmap_size;
+    tc.words = 0;
+
+    word = strchr(term, ':');
+    if (word)
+    {
+      *word++ = 0;
+      tc.field = find_field(term);
+      if (!tc.field)
+      {
+        printf("unknown field '%s' in '%s'; the fields are", term, argv[i]);
+        for (j = 0; j < GMEINDEX_FIELD_COUNT; j++)
+          printf(" %s", gmeindex_field_names[j]);
+        printf("\n");
+        return 1;
+      }
+    }
+    else
+      word = term;
+    len = strlen(word);
+    if (len && word[len - 1] == '*')
+    {
+      word[len - 1] = 0;
+      tc.prefix = 1;
+    }
+
+    /* run the words through the same tokenizer the index was built with */
+    last_word[0] = 0;
+    gmeindex_tokenize(word, remember_word, last_word);
+    tc.last_word = last_word;
+    gmeindex_tokenize(word, match_word, &tc);
+    if (!tc.words)
+    {
+      if (!tc.prefix)
+      {
+        printf("nothing to search for in '%s'\n", argv[i]);
+        return 1;
+      }
+      match_word("", &tc);  /* "field:*" matches anything in that field */
+    }
+  }
+
+  for (track = 0; track < index.track_count; track++)
+  {
+    if (!(matches[track >> 3] & (1 << (track & 7))))
+      continue;
+    match_count++;
+    if (count_only)
+      continue;
+    printf("%s [%d]: %s - %s (%s; %s) %d ms\n",
+      gmeindex_file(&index, gmeindex_track_field(&index, track, GMEINDEX_TRACK_FILE)),
+      gmeindex_track_field(&index, track, GMEINDEX_TRACK_NUMBER),
+      gmeindex_track_string(&index, track, GMEINDEX_TRACK_GAME),
+      gmeindex_track_string(&index, track, GMEINDEX_TRACK_SONG),
+      gmeindex_track_string(&index, track, GMEINDEX_TRACK_AUTHOR),
+      gmeindex_track_string(&index, track, GMEINDEX_TRACK_SYSTEM),
+      gmeindex_track_field(&index, track, GMEINDEX_TRACK_LENGTH));
+  }
+
+  printf("%d matching tracks (%.2f ms)\n", match_count,
+    (now() - start_time) * 1000.0);
+
+  free(matches);
+  free(word_matches);
+  gmeindex_close(&index);
+
+  return 0;
+}
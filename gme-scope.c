@@ -0,0 +1,508 @@
+/*
+ * Render the oscilloscope from gme-sdl to video frames without a display
+ *
+ * Each track is emulated from start to finish as fast as the CPU allows
+ * and written out as a .wav file together with the scope frames for the
+ * same audio, either as one file of raw 512x256 RGB24 frames at 30 frames
+ * per second or as a sequence of .ppm images. The raw frames can be muxed
+ * with the audio by e.g.:
+ *
+ *   ffmpeg -f rawvideo -pix_fmt rgb24 -s 512x256 -r 30 -i scope-01.rgb \
+ *     -i scope-01.wav scope-01.mp4
+ *
+ * Emulation is inherently sequential, but the frames don't depend on one
+ * another: audio is emulated in batches of frames, and while the next
+ * batch is being emulated the frames of the previous one are drawn across
+ * all CPUs and written out in order. The drawing threads are started once
+ * per run and handed one batch after another.
+ *
+ * Compile using:
+ *   gcc -O2 -Wall gme-scope.c gamemusic.c parallel.c scope.c wav.c \
+ *     -o gme-scope -lgme -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "parallel.h"
+#include "scope.h"
+#include "wav.h"
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define FRAME_RATE 30
+#define FRAME_SAMPLES (SAMPLE_RATE / FRAME_RATE * CHANNELS)
+#define FRAME_PIXELS (SCOPE_WIDTH * SCOPE_HEIGHT)
+#define FRAME_BYTES (FRAME_PIXELS * 3)
+#define BATCH_FRAMES 32
+#define DEFAULT_PREFIX "scope"
+
+/* A batch of frames on its way from the emulator to the output files */
+typedef struct
+{
+  short audio[BATCH_FRAMES * FRAME_SAMPLES];
+  unsigned int colors[BATCH_FRAMES];
+  unsigned int *pixels;   /* BATCH_FRAMES frames of 0x00RRGGBB */
+  unsigned char *rgb;     /* BATCH_FRAMES frames of RGB24 */
+  int first_frame;
+  int frame_count;
+  int busy;               /* handed to the writer and not written yet */
+} batch_t;
+
+/* The threads that draw a batch's frames along with the writer */
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t start;   /* there's a batch to draw, or it's time to quit */
+  pthread_cond_t done;    /* the batch's last frame has been drawn */
+  batch_t *batch;         /* the batch being drawn, if any */
+  int next_frame;         /* next frame of the batch to hand out */
+  int frames_left;        /* frames of the batch not drawn yet */
+  int quit;
+  pthread_t *threads;
+  int started;
+} draw_pool_t;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  batch_t *pending;       /* next batch for the writer */
+  int finished;           /* no more batches are coming */
+  int failed;
+  int thread_count;
+  draw_pool_t draw;
+  int ppm;
+  const char *prefix;
+  int track;
+  FILE *wav;
+  FILE *video;
+} writer_t;
+
+static void draw_frame(int index, void *context)
+{
+  batch_t *batch = (batch_t *)context;
+  unsigned int *pixels = &batch->pixels[index * FRAME_PIXELS];
+  unsigned char *rgb = &batch->rgb[index * FRAME_BYTES];
+  int i;
+
+  /* the same 512 samples that gme-sdl shows for this 1/30 s */
+  scope_draw(pixels, SCOPE_WIDTH, &batch->audio[index * FRAME_SAMPLES],
+    batch->colors[index]);
+  for (i = 0; i < FRAME_PIXELS; i++)
+  {
+    rgb[i * 3 + 0] = (pixels[i] >> 16) & 0xFF;
+    rgb[i * 3 + 1] = (pixels[i] >> 8) & 0xFF;
+    rgb[i * 3 + 2] = pixels[i] & 0xFF;
+  }
+}
+
+static void *draw_thread(void *context)
+{
+  draw_pool_t *pool = (draw_pool_t *)context;
+  batch_t *batch;
+  int index;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;)
+  {
+    while (!pool->quit &&
+      (!pool->batch || pool->next_frame >= pool->batch->frame_count))
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->quit)
+      break;
+    batch = pool->batch;
+    index = pool->next_frame++;
+    pthread_mutex_unlock(&pool->lock);
+
+    draw_frame(index, batch);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->frames_left == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* Start helper_count drawing threads; fewer if some can't be created */
+static void draw_pool_start(draw_pool_t *pool, int helper_count)
+{
+  int i;
+
+  memset(pool, 0, sizeof(draw_pool_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = (pthread_t *)malloc(helper_count * sizeof(pthread_t));
+  if (!pool->threads)
+    return;
+  for (i = 0; i < helper_count; i++)
+  {
+    if (pthread_create(&pool->threads[pool->started], NULL, draw_thread,
+      pool))
+      break;
+    pool->started++;
+  }
+}
+
+static void draw_pool_stop(draw_pool_t *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->started; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool->threads);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/* Draw every frame of a batch; the calling thread draws its share too */
+static void draw_batch(draw_pool_t *pool, batch_t *batch)
+{
+  int index;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->batch = batch;
+  pool->next_frame = 0;
+  pool->frames_left = batch->frame_count;
+  pthread_cond_broadcast(&pool->start);
+  while (pool->next_frame < batch->frame_count)
+  {
+    index = pool->next_frame++;
+    pthread_mutex_unlock(&pool->lock);
+    draw_frame(index, batch);
+    pthread_mutex_lock(&pool->lock);
+    pool->frames_left--;
+  }
+  while (pool->frames_left)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pool->batch = NULL;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static int write_frames(writer_t *writer, batch_t *batch)
+{
+  char filename[1024];
+  FILE *f;
+  int i;
+
+  if (wav_write(writer->wav, batch->audio, batch->frame_count * FRAME_SAMPLES))
+    return 1;
+
+  if (!writer->ppm)
+    return fwrite(batch->rgb, FRAME_BYTES, batch->frame_count,
+      writer->video) != (size_t)batch->frame_count;
+
+  for (i = 0; i < batch->frame_count; i++)
+  {
+    snprintf(filename, sizeof(filename), "%s-%02d-%06d.ppm", writer->prefix,
+      writer->track + 1, batch->first_frame + i);
+    f = fopen(filename, "wb");
+    if (!f)
+    {
+      perror(filename);
+      return 1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", SCOPE_WIDTH, SCOPE_HEIGHT);
+    fwrite(&batch->rgb[i * FRAME_BYTES], FRAME_BYTES, 1, f);
+    if (fclose(f))
+    {
+      perror(filename);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void *writer_thread(void *context)
+{
+  writer_t *writer = (writer_t *)context;
+  batch_t *batch;
+  int failed;
+
+  pthread_mutex_lock(&writer->lock);
+  for (;;)
+  {
+    while (!writer->pending && !writer->finished)
+      pthread_cond_wait(&writer->cond, &writer->lock);
+    batch = writer->pending;
+    if (!batch)
+      break;
+    writer->pending = NULL;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    /* once a write has failed, the rest of the track is just drained */
+    failed = writer->failed;
+    if (!failed)
+    {
+      draw_batch(&writer->draw, batch);
+      failed = write_frames(writer, batch);
+      if (failed)
+        printf("%s: track %d: write failed\n", writer->prefix,
+          writer->track + 1);
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->failed = failed;
+    batch->busy = 0;
+    pthread_cond_broadcast(&writer->cond);
+  }
+  pthread_mutex_unlock(&writer->lock);
+
+  return NULL;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int render_track(gamemusic_player_t *player, const char *filename,
+  int track, writer_t *writer, batch_t *batches)
+{
+  char output[1024];
+  pthread_t thread;
+  scope_color_t color;
+  gme_info_t *info;
+  gme_err_t err;
+  batch_t *batch;
+  int frame_total, frame, length = 0;
+  int i, j;
+  double start_time, elapsed;
+
+  err = gamemusic_player_track_info(player, &info, track);
+  if (!err)
+  {
+    length = info->play_length;
+    gme_free_info(info);
+    err = gamemusic_player_start_track(player, track);
+  }
+  if (err)
+  {
+    printf("%s: track %d: %s\n", filename, track + 1, err);
+    return 2;
+  }
+  frame_total = (int)((long long)length * FRAME_RATE / 1000);
+
+  snprintf(output, sizeof(output), "%s-%02d.wav", writer->prefix, track + 1);
+  writer->wav = wav_open(output, SAMPLE_RATE, CHANNELS);
+  if (!writer->wav)
+    return 2;
+  writer->video = NULL;
+  if (!writer->ppm)
+  {
+    snprintf(output, sizeof(output), "%s-%02d.rgb", writer->prefix, track + 1);
+    writer->video = fopen(output, "wb");
+    if (!writer->video)
+    {
+      perror(output);
+      wav_close(writer->wav);
+      return 2;
+    }
+  }
+
+  writer->pending = NULL;
+  writer->finished = 0;
+  writer->failed = 0;
+  writer->track = track;
+  if (pthread_create(&thread, NULL, writer_thread, writer))
+  {
+    printf("failed to create writer thread\n");
+    wav_close(writer->wav);
+    if (writer->video)
+      fclose(writer->video);
+    return 3;
+  }
+
+  /* seed the colour cycle from the file and track, much as gme-sdl does */
+  scope_color_init(&color, (track << 24) | (filename[0] << 16) | strlen(filename));
+
+  start_time = now();
+  for (frame = 0, i = 0; frame < frame_total; i ^= 1)
+  {
+    batch = &batches[i];
+
+    /* wait for the writer to be done with this buffer from two batches ago */
+    pthread_mutex_lock(&writer->lock);
+    while (batch->busy)
+      pthread_cond_wait(&writer->cond, &writer->lock);
+    if (writer->failed)
+    {
+      pthread_mutex_unlock(&writer->lock);
+      break;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    batch->first_frame = frame;
+    batch->frame_count = frame_total - frame;
+    if (batch->frame_count > BATCH_FRAMES)
+      batch->frame_count = BATCH_FRAMES;
+    err = gme_play(player->emu, batch->frame_count * FRAME_SAMPLES,
+      batch->audio);
+    if (err)
+    {
+      printf("%s: track %d: %s\n", filename, track + 1, err);
+      break;
+    }
+    /* colours carry over from frame to frame, so they're picked here,
+     * in order */
+    for (j = 0; j < batch->frame_count; j++)
+      batch->colors[j] = scope_color_next(&color);
+    frame += batch->frame_count;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending)
+      pthread_cond_wait(&writer->cond, &writer->lock);
+    batch->busy = 1;
+    writer->pending = batch;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+  }
+
+  pthread_mutex_lock(&writer->lock);
+  writer->finished = 1;
+  pthread_cond_broadcast(&writer->cond);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(thread, NULL);
+  elapsed = now() - start_time;
+
+  if (wav_close(writer->wav))
+    writer->failed = 1;
+  if (writer->video && fclose(writer->video))
+    writer->failed = 1;
+  if (err || writer->failed)
+    return 2;
+
+  printf("%s: track %d: %d frames (%.1f s) in %.1f s", filename, track + 1,
+    frame_total, length / 1000.0, elapsed);
+  if (elapsed > 0.0)
+    printf(", %.1fx realtime", length / 1000.0 / elapsed);
+  printf("\n");
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  gamemusic_player_t player;
+  writer_t writer;
+  batch_t *batches;
+  gme_err_t err;
+  int track = -1;
+  int track_count;
+  int ret = 0, track_ret;
+  int opt;
+  int i;
+
+  writer.thread_count = 0;
+  writer.ppm = 0;
+  writer.prefix = DEFAULT_PREFIX;
+  while ((opt = getopt(argc, argv, "j:o:p")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        writer.thread_count = atoi(optarg);
+        break;
+      case 'o':
+        writer.prefix = optarg;
+        break;
+      case 'p':
+        writer.ppm = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
+
+  if (argc - optind < 1)
+  {
+    printf("USAGE: gme-scope [-j threads] [-o prefix] [-p] <game music file> [track number]\n");
+    return 1;
+  }
+  if (argc - optind > 1)
+    track = atoi(argv[optind + 1]) - 1;
+  if (writer.thread_count < 1)
+    writer.thread_count = parallel_cpu_count();
+
+  err = gamemusic_player_open(&player, argv[optind], SAMPLE_RATE);
+  if (err)
+  {
+    printf("%s: %s\n", argv[optind], err);
+    return 2;
+  }
+  track_count = gamemusic_player_track_count(&player);
+  if (track >= track_count || (track < 0 && argc - optind > 1))
+  {
+    printf("%s: no track %s (the file has %d)\n", argv[optind],
+      argv[optind + 1], track_count);
+    gamemusic_player_close(&player);
+    return 1;
+  }
+
+  /* two batches: one being emulated while the other is drawn */
+  batches = (batch_t *)calloc(2, sizeof(batch_t));
+  if (!batches)
+  {
+    printf("failed to allocate memory\n");
+    return 3;
+  }
+  for (i = 0; i < 2; i++)
+  {
+    batches[i].pixels = (unsigned int *)malloc(
+      BATCH_FRAMES * FRAME_PIXELS * sizeof(unsigned int));
+    batches[i].rgb = (unsigned char *)malloc(BATCH_FRAMES * FRAME_BYTES);
+    if (!batches[i].pixels || !batches[i].rgb)
+    {
+      printf("failed to allocate memory\n");
+      return 3;
+    }
+  }
+  pthread_mutex_init(&writer.lock, NULL);
+  pthread_cond_init(&writer.cond, NULL);
+  /* the writer thread is one of the drawing threads */
+  draw_pool_start(&writer.draw, writer.thread_count - 1);
+
+  for (i = 0; i < track_count; i++)
+  {
+    if (track >= 0 && i != track)
+      continue;
+    track_ret = render_track(&player, argv[optind], i, &writer, batches);
+    if (track_ret)
+      ret = track_ret;
+    if (track_ret == 3)
+      break;
+  }
+
+  draw_pool_stop(&writer.draw);
+  pthread_cond_destroy(&writer.cond);
+  pthread_mutex_destroy(&writer.lock);
+  for (i = 0; i < 2; i++)
+  {
+    free(batches[i].pixels);
+    free(batches[i].rgb);
+  }
+  free(batches);
+  gamemusic_player_close(&player);
+
+  return ret;
+}
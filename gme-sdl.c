@@ -3,15 +3,24 @@
  *   by Mike Melanson (mike -at- multimedia.cx)
  *
  * Compile using:
- *   gcc -g -Wall gme-sdl.c -o gme-sdl `sdl-config --cflags --libs` -lgme
+ *   gcc -g -Wall gme-sdl.c gamemusic.c loudness.c renderahead.c scope.c \
+ *     -o gme-sdl `sdl-config --cflags --libs` -lgme -lm -lpthread
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <gme/gme.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_audio.h>
 
+#include "gamemusic.h"
+#include "loudness.h"
+#include "renderahead.h"
+#include "scope.h"
+
 #define SAMPLE_RATE 44100
 #define CHANNELS 2
 
@@ -20,21 +29,92 @@
 /* arbitrary limit: voices correspond to numbers 1-9 on keyboard */
 #define MAX_VOICES 9
 #define FRAME_RATE 30
-#define WIDTH 512
-#define HEIGHT 256
+#define WIDTH SCOPE_WIDTH
+#define HEIGHT SCOPE_HEIGHT
 #define CAPTION_STRING_LEN 100
-
-static SDL_mutex *audio_mutex;
+/* seconds of audio to keep rendered ahead of the device; kept short since
+ * muting a voice is only heard once the queued audio has played */
+#define RENDER_AHEAD 0.5
+/* a stream is only ever rendered by one worker at a time, and each player
+ * has a single stream */
+#define RENDER_THREADS 1
+
+/* SDL_USEREVENT codes that wake up the main loop */
+#define EVENT_FRAME 1      /* time to draw the next frame */
+#define EVENT_AUDIO 2      /* audio queue ran low, or the stream ended */
+#define EVENT_BENCHMARK 3  /* benchmark period is over */
+
+/* the most recent second of audio sent to the device, for the scope */
 static short audio_buffer[BUFFER_SIZE];
-static unsigned int audio_start = 0;
 static unsigned int audio_end = 0;
 static int start_video = 0;
 Uint32 base_clock;
 
+/* rendered audio, and the part of the current chunk not yet fed */
+static renderahead_stream_t *render_stream;
+static const short *render_chunk = NULL;
+static int render_chunk_samples;
+static int render_chunk_pos;
+
+/* a frame event is waiting in the queue; don't pile up more */
+static volatile int frame_pending = 0;
+
+static void push_user_event(int code)
+{
+  SDL_Event event;
+
+  event.type = SDL_USEREVENT;
+  event.user.code = code;
+  event.user.data1 = NULL;
+  event.user.data2 = NULL;
+  SDL_PushEvent(&event);
+}
+
+static Uint32 frame_timer(Uint32 interval, void *unused)
+{
+  if (!frame_pending)
+  {
+    frame_pending = 1;
+    push_user_event(EVENT_FRAME);
+  }
+  return interval;
+}
+
+static Uint32 benchmark_timer(Uint32 interval, void *unused)
+{
+  push_user_event(EVENT_BENCHMARK);
+  return 0;  /* one-shot */
+}
+
+/* called by the render-ahead stage when the queue has drained to its low
+ * water mark (the workers are refilling it) or the stream has ended */
+static void audio_notify(void *unused)
+{
+  push_user_event(EVENT_AUDIO);
+}
+
+static double thread_cpu_seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double process_cpu_seconds(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
 void gme_feedaudio(void *unused, Uint8 *stream, int req_len_in_bytes)
 {
-  unsigned int actual_len;
-  int buffer_start_in_bytes, buffer_end_in_bytes;
+  int req_samples = req_len_in_bytes / 2;
+  int actual_len;
+  int viz_len;
 
   if (!start_video)
   {
@@ -42,44 +122,59 @@ void gme_feedaudio(void *unused, Uint8 *stream, int req_len_in_bytes)
     base_clock = SDL_GetTicks();
   }
 
-  SDL_LockMutex(audio_mutex);
-
-  /* if there is no audio ready to feed, leave */
-  if (audio_start >= audio_end)
+  while (req_samples > 0)
   {
-    SDL_UnlockMutex(audio_mutex);
-    return;
-  }
-
-  buffer_start_in_bytes = (audio_start % BUFFER_SIZE) * 2;
-  buffer_end_in_bytes = (audio_end % BUFFER_SIZE ) * 2;
-
-  /* decide how much to feed */
-  if (buffer_start_in_bytes > buffer_end_in_bytes)
-    actual_len = BUFFER_SIZE * 2 - buffer_start_in_bytes;
-  else
-    actual_len = buffer_end_in_bytes - buffer_start_in_bytes;
-  if (actual_len > req_len_in_bytes)
-    actual_len = req_len_in_bytes;
+    if (!render_chunk)
+    {
+      /* never block the audio thread; if nothing is ready, leave */
+      render_chunk = renderahead_dequeue(render_stream, &render_chunk_samples, 0);
+      render_chunk_pos = 0;
+      if (!render_chunk)
+        return;
+    }
 
-  /* feed it */
-  SDL_MixAudio(stream, (uint8_t *)(&audio_buffer[buffer_start_in_bytes / 2]), 
-    actual_len, SDL_MIX_MAXVOLUME);
-  audio_start += actual_len / 2;
+    /* decide how much to feed */
+    actual_len = render_chunk_samples - render_chunk_pos;
+    if (actual_len > req_samples)
+      actual_len = req_samples;
 
-  /* wrap-around case */
-  if (actual_len < req_len_in_bytes)
-  {
-    stream += actual_len;
-    actual_len = req_len_in_bytes - actual_len;
-    buffer_start_in_bytes = (audio_start % BUFFER_SIZE) * 2;
     /* feed it */
-    SDL_MixAudio(stream, (uint8_t *)(&audio_buffer[buffer_start_in_bytes / 2]), 
-      actual_len, SDL_MIX_MAXVOLUME);
-    audio_start += actual_len / 2;
+    SDL_MixAudio(stream, (uint8_t *)(&render_chunk[render_chunk_pos]),
+      actual_len * 2, SDL_MIX_MAXVOLUME);
+
+    /* remember it for the visualization (wrap-around case included) */
+    viz_len = BUFFER_SIZE - (audio_end % BUFFER_SIZE);
+    if (viz_len > actual_len)
+      viz_len = actual_len;
+    memcpy(&audio_buffer[audio_end % BUFFER_SIZE],
+      &render_chunk[render_chunk_pos], viz_len * 2);
+    memcpy(audio_buffer, &render_chunk[render_chunk_pos + viz_len],
+      (actual_len - viz_len) * 2);
+    audio_end += actual_len;
+
+    stream += actual_len * 2;
+    req_samples -= actual_len;
+    render_chunk_pos += actual_len;
+    if (render_chunk_pos == render_chunk_samples)
+    {
+      renderahead_release(render_stream);
+      render_chunk = NULL;
+    }
   }
+}
 
-  SDL_UnlockMutex(audio_mutex);
+/* Look up the gain that brings a track to the common loudness level, if
+ * gme-loudness has measured it */
+static int track_gain(const char *filename, int track, int normalize)
+{
+  loudness_t loudness;
+
+  if (!normalize || loudness_read_track(filename, track, &loudness))
+    return LOUDNESS_GAIN_UNITY;
+
+  printf("loudness: %.1f LUFS; applying %+.1f dB gain\n",
+    loudness.loudness, loudness.gain);
+  return loudness_gain_to_fixed(loudness.gain);
 }
 
 int main(int argc, char *argv[])
@@ -89,52 +184,110 @@ int main(int argc, char *argv[])
   SDL_AudioSpec actual_fmt;
   SDL_Event event;
   unsigned int *pixels;
-  int keyPressActive;
+  SDL_TimerID frame_timer_id;
+  gamemusic_player_t player;
   Music_Emu *emu;
   gme_info_t *info;
   gme_err_t gmeErr;
-  int track;
+  int track, previous_track;
   int i;
   int voice_flags[MAX_VOICES];
   int finished;
-  int ms_to_update_video;
   int frame_counter;
-  unsigned int pixel;
-  Uint32 current_tick;
-  int audio_started;
-  short *viz_buffer;
+  int last_frame;
+  scope_color_t color;
   int print_metadata = 1;
   char caption_string[CAPTION_STRING_LEN];
+  renderahead_pool_t *render_pool;
+  double render_ahead = RENDER_AHEAD;
+  int render_chunks;
+  int verbose = 0;
+  int normalize = 1;
+  int benchmark = 0;
+  unsigned int wakeups = 0;
+  unsigned int frames_drawn = 0;
+  Uint32 benchmark_start = 0;
+  double main_cpu_start = 0.0, process_cpu_start = 0.0;
+  double elapsed;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:b:nv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a':
+        render_ahead = atof(optarg);
+        break;
+      case 'b':
+        benchmark = atoi(optarg);
+        break;
+      case 'n':
+        normalize = 0;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        argc = 0;  /* force the usage message */
+        break;
+    }
+  }
 
-  unsigned char r_color, g_color, b_color;
-  char r_inc, g_inc, b_inc;
-
-  if (argc < 2)
+  if (argc - optind < 1)
   {
-    printf("USAGE: gme-pulse <game music file> [track number]\n");
+    printf("USAGE: gme-sdl [-a render-ahead seconds (default 0.5)] [-b benchmark seconds] [-n] [-v] <game music file> [track number]\n");
     return 1;
   }
 
   /* initialize the engine based on the file parameter */
-  gmeErr = gme_open_file(argv[1], &emu, SAMPLE_RATE);
+  gmeErr = gamemusic_player_open(&player, argv[optind], SAMPLE_RATE);
   if (gmeErr)
   {
     printf("%s\n", gmeErr);
     return 1;
   }
-  if (argc >= 3)
-    track = atoi(argv[2]);
+  if (argc - optind >= 2)
+    track = atoi(argv[optind + 1]);
   else
     track = 1;
-  if (track < 1 || track > gme_track_count(emu))
+  if (track < 1 || track > gamemusic_player_track_count(&player))
   {
     printf("there is no track %d; playing track 1 instead\n", track);
     track = 1;
   }
-  gme_start_track(emu, track - 1);
+  gmeErr = gamemusic_player_start_track(&player, track - 1);
+  if (gmeErr)
+  {
+    printf("%s\n", gmeErr);
+    gamemusic_player_close(&player);
+    return 1;
+  }
+  emu = player.emu;
+
+  /* the queue is made of PERIOD_SIZE chunks; keep at least two so that
+   * one can be refilled while the other plays */
+  render_chunks = (int)(render_ahead * BUFFER_SIZE / PERIOD_SIZE + 0.5);
+  if (render_chunks < 2)
+    render_chunks = 2;
+
+  /* emulate on worker threads; the audio callback only dequeues */
+  render_stream = NULL;
+  render_pool = renderahead_pool_create(RENDER_THREADS);
+  if (render_pool)
+    render_stream = renderahead_stream_create(render_pool, emu, 0,
+      track_gain(argv[optind], track - 1, normalize), PERIOD_SIZE,
+      render_chunks);
+  if (!render_pool || !render_stream)
+  {
+    printf("could not set up render-ahead buffers\n");
+    exit(1);
+  }
+  /* let the queue drain to half before refilling, and hear about it */
+  renderahead_set_notify(render_stream,
+    render_chunks / 2, audio_notify, NULL);
 
   /* initialize SDL audio and start playing */
-  if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) < 0)
+  if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO|SDL_INIT_TIMER) < 0)
   {
     printf ("could not initialize SDL: %s\n", SDL_GetError());
     exit(1);
@@ -153,7 +306,6 @@ int main(int argc, char *argv[])
     printf("could not open SDL audio: %s\n", SDL_GetError());
     exit(1);
   }
-  audio_mutex = SDL_CreateMutex();
 
   /* create video window */
   screen = SDL_SetVideoMode(WIDTH, HEIGHT, 32, SDL_SWSURFACE);
@@ -168,30 +320,39 @@ int main(int argc, char *argv[])
 
   /* initialize the visualization matters */
   frame_counter = 0;
-  ms_to_update_video = frame_counter * 1000 / FRAME_RATE;
-  r_color = g_color = b_color = 250;
-  srand((argc << 24) | (argv[1][0] << 16) | strlen(argv[1]));
-  r_inc = -1 * (rand() % 3 + 1);
-  g_inc = -1 * (rand() % 3 + 1);
-  b_inc = -1 * (rand() % 3 + 1);
+  last_frame = -1;
+  scope_color_init(&color, ((argc - optind + 1) << 24) |
+    (argv[optind][0] << 16) | strlen(argv[optind]));
 
   finished = 0;
-  keyPressActive = 0;
-  audio_started = 0;
+  SDL_PauseAudio(0);
+  frame_timer_id = SDL_AddTimer(1000 / FRAME_RATE, frame_timer, NULL);
+  if (benchmark)
+  {
+    printf("benchmark: running for %d seconds\n", benchmark);
+    SDL_AddTimer(benchmark * 1000, benchmark_timer, NULL);
+    benchmark_start = SDL_GetTicks();
+    main_cpu_start = thread_cpu_seconds();
+    process_cpu_start = process_cpu_seconds();
+  }
+
+  /* everything is driven by events: the frame timer, audio queue
+   * notifications and input; sleep until one of them arrives */
   while (!finished)
   {
     if (print_metadata)
     {
-      gmeErr = gme_track_info(emu, &info, track - 1);
+      gmeErr = gamemusic_player_track_info(&player, &info, track - 1);
       snprintf(caption_string, CAPTION_STRING_LEN, "%s - %s (Game Music Emu)",
         info->game, info->song);
       SDL_WM_SetCaption(caption_string, NULL);
-      printf("Playing track %d / %d\n", track, gme_track_count(emu));
+      printf("Playing track %d / %d\n", track,
+        gamemusic_player_track_count(&player));
       printf("system: %s\ngame: %s\nsong: %s\nlength: %d ms\nplay length: %d ms\n",
         info->system, info->game, info->song, info->length, info->play_length);
       for (i = 1; i <= gme_voice_count(emu); i++)
         printf("voice %d: %s\n", i, gme_voice_name(emu, i - 1));
-      if (gme_track_count(emu) > 1)
+      if (gamemusic_player_track_count(&player) > 1)
         printf("  press left or right to change tracks\n");
       printf("  press number keys to toggle voices\n");
       printf("  press ESC or q to exit\n\n");
@@ -199,128 +360,208 @@ int main(int argc, char *argv[])
       print_metadata = 0;
     }
 
-    /* check if it's time to generate more audio */
-    SDL_LockMutex(audio_mutex);
-    if ((audio_end - audio_start) < (PERIOD_SIZE / 2))
+    /* SDL 1.2 has no blocking wait: SDL_WaitEvent() pumps the event
+     * queue and sleeps 10 ms at a time until something shows up. What
+     * this loop saves is the work done on each of those polls. */
+    if (!SDL_WaitEvent(&event))
     {
-      gmeErr = gme_play(emu, PERIOD_SIZE, &audio_buffer[audio_end % BUFFER_SIZE]);
-      if (gmeErr)
-      {
-        SDL_UnlockMutex(audio_mutex);
-        printf("%s\n", gmeErr);
-        break;
-      }
-      audio_end += PERIOD_SIZE;
+      printf("error waiting for events: %s\n", SDL_GetError());
+      break;
     }
-    SDL_UnlockMutex(audio_mutex);
+    wakeups++;
 
-    if (!audio_started)
+    /* handle everything that's waiting, not just the first event */
+    do
     {
-      audio_started = 1;
-      SDL_PauseAudio(0);
-    }
-
-    /* see if it's time to update the visualization */
-    current_tick = SDL_GetTicks() - base_clock;
-    if (start_video && current_tick >= ms_to_update_video)
-    {
-      /* decide on a pixel color */
-      pixel = (r_color << 16) | (g_color << 8) | (b_color << 0);
-      r_color += r_inc;
-      if (r_color <  64 || r_color > 250)
-        r_inc *= -1;
-      g_color += g_inc;
-      if (g_color < 192 || g_color > 250)
-        g_inc *= -1;
-      b_color += b_inc;
-      if (b_color < 128 || b_color > 250)
-        b_inc *= -1;
-
-      if (SDL_MUSTLOCK(screen))
-        SDL_LockSurface(screen);
-
-      memset(pixels, 0, WIDTH * HEIGHT * sizeof(unsigned int));
-      viz_buffer = &audio_buffer[(frame_counter % FRAME_RATE) * BUFFER_SIZE / FRAME_RATE];
-      for (i = 0; i < WIDTH * CHANNELS; i++)
+      switch (event.type)
       {
-        if (i & 1)  /* right channel data */
-          pixels[WIDTH * ((192 - (viz_buffer[i] / 512)) - 1) + (i >> 1)] = pixel;
-        else        /* left channel data */
-          pixels[WIDTH * (64 - (viz_buffer[i] / 512)) + (i >> 1)] = pixel;
-      }
-      for (i = 0; i < WIDTH; i++)
-        pixels[128 * WIDTH + i] = 0xFFFFFFFF;
-
-      if (SDL_MUSTLOCK(screen))
-        SDL_UnlockSurface(screen);
-      SDL_UpdateRect(screen, 0, 0, 0, 0);
-
-      frame_counter++;
-      ms_to_update_video = frame_counter * 1000 / FRAME_RATE;
-    }
-
-    SDL_PollEvent(&event);
-    if (keyPressActive && event.type == SDL_KEYUP)
-      keyPressActive = 0;
-
-    if (!keyPressActive && event.type == SDL_KEYDOWN)
-    {
-      keyPressActive = 1;
-
-      switch (event.key.keysym.sym)
-      {
-        case SDLK_ESCAPE:
-        case SDLK_q:
-          finished = 1;
+        case SDL_USEREVENT:
+          switch (event.user.code)
+          {
+            case EVENT_FRAME:
+              frame_pending = 0;
+
+              /* pick the frame matching the audio clock, which skips frames
+               * if drawing falls behind */
+              if (!start_video)
+                break;
+              frame_counter = (SDL_GetTicks() - base_clock) * FRAME_RATE / 1000;
+              if (frame_counter == last_frame)
+                break;
+
+              if (SDL_MUSTLOCK(screen))
+                SDL_LockSurface(screen);
+
+              scope_draw(pixels, screen->pitch / sizeof(unsigned int),
+                &audio_buffer[(frame_counter % FRAME_RATE) * BUFFER_SIZE / FRAME_RATE],
+                scope_color_next(&color));
+
+              if (SDL_MUSTLOCK(screen))
+                SDL_UnlockSurface(screen);
+              SDL_UpdateRect(screen, 0, 0, 0, 0);
+
+              /* report the queue depth about once a second */
+              if (verbose && frame_counter / FRAME_RATE != last_frame / FRAME_RATE)
+              {
+                printf("\rqueued: %.1f / %.1f s, underruns: %lu  ",
+                  (float)renderahead_queued(render_stream) / BUFFER_SIZE,
+                  (float)renderahead_capacity(render_stream) / BUFFER_SIZE,
+                  renderahead_underruns(render_stream));
+                fflush(stdout);
+              }
+
+              last_frame = frame_counter;
+              frames_drawn++;
+              break;
+
+            case EVENT_AUDIO:
+              /* the workers refill the queue by themselves; just make sure
+               * the emulator hasn't given up */
+              gmeErr = renderahead_error(render_stream);
+              if (gmeErr)
+              {
+                printf("%s\n", gmeErr);
+                finished = 1;
+              }
+              break;
+
+            case EVENT_BENCHMARK:
+              finished = 1;
+              break;
+          }
           break;
 
-        case SDLK_1:
-        case SDLK_2:
-        case SDLK_3:
-        case SDLK_4:
-        case SDLK_5:
-        case SDLK_6:
-        case SDLK_7:
-        case SDLK_8:
-        case SDLK_9:
-          i = event.key.keysym.sym - SDLK_1;
-          if (i < gme_voice_count(emu))
+        case SDL_ACTIVEEVENT:
+          /* no point in drawing while iconified */
+          if (!(event.active.state & SDL_APPACTIVE))
+            break;
+          if (event.active.gain && !frame_timer_id)
+            frame_timer_id = SDL_AddTimer(1000 / FRAME_RATE, frame_timer, NULL);
+          else if (!event.active.gain && frame_timer_id)
           {
-            voice_flags[i] ^= 1;
-            gme_mute_voice(emu, i, voice_flags[i]);
+            SDL_RemoveTimer(frame_timer_id);
+            frame_timer_id = NULL;
           }
           break;
 
-        case SDLK_LEFT:
-        case SDLK_RIGHT:
-          /* don't change tracks unless there are multiple tracks */
-          if (gme_track_count(emu) <= 1)
-            break;
+        case SDL_QUIT:
+          finished = 1;
+          break;
 
-          if (event.key.keysym.sym == SDLK_LEFT)
-            i = -1;
-          else
-            i = 1;
-          track += i;
-          if (track > gme_track_count(emu))
-            track = 1;
-          if (track < 1)
-            track = gme_track_count(emu);
-          gme_start_track(emu, track - 1);
-          print_metadata = 1;
+        case SDL_KEYDOWN:
+          switch (event.key.keysym.sym)
+          {
+            case SDLK_ESCAPE:
+            case SDLK_q:
+              finished = 1;
+              break;
+
+            case SDLK_1:
+            case SDLK_2:
+            case SDLK_3:
+            case SDLK_4:
+            case SDLK_5:
+            case SDLK_6:
+            case SDLK_7:
+            case SDLK_8:
+            case SDLK_9:
+              i = event.key.keysym.sym - SDLK_1;
+              if (i < gme_voice_count(emu))
+              {
+                /* takes effect once the audio already queued has played */
+                voice_flags[i] ^= 1;
+                renderahead_pause(render_stream);
+                gme_mute_voice(emu, i, voice_flags[i]);
+                renderahead_resume(render_stream);
+              }
+              break;
+
+            case SDLK_LEFT:
+            case SDLK_RIGHT:
+              /* don't change tracks unless there are multiple tracks */
+              if (gamemusic_player_track_count(&player) <= 1)
+                break;
+
+              if (event.key.keysym.sym == SDLK_LEFT)
+                i = -1;
+              else
+                i = 1;
+              previous_track = track;
+              track += i;
+              if (track > gamemusic_player_track_count(&player))
+                track = 1;
+              if (track < 1)
+                track = gamemusic_player_track_count(&player);
+
+              /* keep the audio callback and the workers out of the way while
+               * switching; the audio queued for the old track is dropped */
+              SDL_LockAudio();
+              renderahead_pause(render_stream);
+
+              /* moving to another container entry swaps in a new emulator
+               * (played from the same mapping), so restore the voice mutes */
+              gmeErr = gamemusic_player_start_track(&player, track - 1);
+              if (gmeErr)
+              {
+                /* a bad entry; go back to where we were */
+                printf("track %d: %s\n", track, gmeErr);
+                track = previous_track;
+                gmeErr = gamemusic_player_start_track(&player, track - 1);
+              }
+              if (gmeErr)
+              {
+                printf("track %d: %s\n", track, gmeErr);
+                SDL_UnlockAudio();
+                finished = 1;
+                break;
+              }
+              emu = player.emu;
+              for (i = 0; i < gme_voice_count(emu) && i < MAX_VOICES; i++)
+                gme_mute_voice(emu, i, voice_flags[i]);
+
+              renderahead_restart(render_stream, emu, 0,
+                track_gain(argv[optind], track - 1, normalize));
+              render_chunk = NULL;
+              SDL_UnlockAudio();
+              print_metadata = 1;
+              break;
+
+            default:
+              break;
+          }
           break;
 
         default:
           break;
       }
-    }
+    } while (SDL_PollEvent(&event));
+  }
 
-    SDL_Delay(1);
+  if (benchmark)
+  {
+    elapsed = (SDL_GetTicks() - benchmark_start) / 1000.0;
+    if (elapsed <= 0.0)
+      elapsed = 1.0;
+    printf("\nbenchmark: %.1f s, %u wake-ups (%.1f per second), %u frames drawn\n",
+      elapsed, wakeups, wakeups / elapsed, frames_drawn);
+    printf("  (wake-ups are returns from SDL_WaitEvent, which itself polls for\n"
+           "  events every 10 ms under SDL 1.2; those polls aren't counted)\n");
+    main_cpu_start = thread_cpu_seconds() - main_cpu_start;
+    process_cpu_start = process_cpu_seconds() - process_cpu_start;
+    printf("  main loop CPU: %.3f s (%.2f%%)\n",
+      main_cpu_start, main_cpu_start * 100.0 / elapsed);
+    printf("  whole process CPU: %.3f s (%.2f%%), underruns: %lu\n",
+      process_cpu_start, process_cpu_start * 100.0 / elapsed,
+      renderahead_underruns(render_stream));
   }
 
+  if (frame_timer_id)
+    SDL_RemoveTimer(frame_timer_id);
   SDL_CloseAudio();
 
-  gme_delete(emu);
+  renderahead_stream_destroy(render_stream);
+  renderahead_pool_destroy(render_pool);
+  gamemusic_player_close(&player);
 
   return 0;
 }
@@ -0,0 +1,223 @@
+/*
+ * On-disk metadata index for a library of game music files
+ *
+ * See gmeindex.h for the layout.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gmeindex.h"
+
+const char *gmeindex_field_names[GMEINDEX_FIELD_COUNT] =
+{
+  "system", "game", "song", "author", "copyright", "dumper", "type"
+};
+
+const int gmeindex_field_words[GMEINDEX_FIELD_COUNT] =
+{
+  GMEINDEX_TRACK_SYSTEM, GMEINDEX_TRACK_GAME, GMEINDEX_TRACK_SONG,
+  GMEINDEX_TRACK_AUTHOR, GMEINDEX_TRACK_COPYRIGHT, GMEINDEX_TRACK_DUMPER,
+  GMEINDEX_TRACK_TYPE
+};
+
+static unsigned int read_le32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+void gmeindex_tokenize(const char *text,
+  void (*emit)(const char *word, void *context), void *context)
+{
+  char word[GMEINDEX_MAX_TOKEN];
+  unsigned char c;
+  int len = 0;
+
+  do
+  {
+    c = (unsigned char)*text;
+    /* letters and digits make up words; high-bit characters (Latin-1)
+     * are kept as they are */
+    if (c && (isalnum(c) || c > 127))
+    {
+      if (len < GMEINDEX_MAX_TOKEN - 1)
+        word[len++] = (c > 127) ? c : tolower(c);
+    }
+    else if (len)
+    {
+      word[len] = 0;
+      emit(word, context);
+      len = 0;
+    }
+  } while (*text++);
+}
+
+int gmeindex_open(gmeindex_t *index, const char *filename)
+{
+  const unsigned char *h;
+  struct stat st;
+  void *map;
+  size_t file_off, track_off, token_off, postings_off, strings_off;
+  int fd;
+
+  memset(index, 0, sizeof(gmeindex_t));
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(filename);
+    return 2;
+  }
+  if (fstat(fd, &st) < 0)
+  {
+    perror(filename);
+    close(fd);
+    return 2;
+  }
+  if (st.st_size < GMEINDEX_HEADER_SIZE)
+  {
+    printf("%s: truncated index\n", filename);
+    close(fd);
+    return 2;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    perror(filename);
+    return 3;
+  }
+  index->data = (const unsigned char *)map;
+  index->size = st.st_size;
+
+  h = index->data;
+  if (memcmp(h, GMEINDEX_SIGNATURE, GMEINDEX_SIGNATURE_SIZE) != 0 ||
+      read_le32(&h[16]) != GMEINDEX_VERSION)
+  {
+    printf("%s: not a version %d index\n", filename, GMEINDEX_VERSION);
+    gmeindex_close(index);
+    return 2;
+  }
+
+  index->file_count   = read_le32(&h[20]);
+  file_off            = read_le32(&h[24]);
+  index->track_count  = read_le32(&h[28]);
+  track_off           = read_le32(&h[32]);
+  index->token_count  = read_le32(&h[36]);
+  token_off           = read_le32(&h[40]);
+  postings_off        = read_le32(&h[44]);
+  strings_off         = read_le32(&h[48]);
+  index->strings_size = read_le32(&h[52]);
+
+  /* the tables are written in this order, so checking the end of each one
+   * against the start of the next bounds everything */
+  if (file_off + (size_t)index->file_count * 4 > track_off ||
+      track_off + (size_t)index->track_count * GMEINDEX_TRACK_SIZE > token_off ||
+      token_off + (size_t)index->token_count * GMEINDEX_TOKEN_SIZE > postings_off ||
+      postings_off > strings_off ||
+      strings_off + index->strings_size > index->size ||
+      index->strings_size == 0 ||
+      index->data[strings_off + index->strings_size - 1] != 0)
+  {
+    printf("%s: corrupt index\n", filename);
+    gmeindex_close(index);
+    return 2;
+  }
+
+  index->files = &h[file_off];
+  index->tracks = &h[track_off];
+  index->tokens = &h[token_off];
+  index->postings = &h[postings_off];
+  index->strings = (const char *)&h[strings_off];
+
+  return 0;
+}
+
+void gmeindex_close(gmeindex_t *index)
+{
+  if (index->data)
+    munmap((void *)index->data, index->size);
+  memset(index, 0, sizeof(gmeindex_t));
+}
+
+static const char *string_at(const gmeindex_t *index, unsigned int offset)
+{
+  if (offset >= index->strings_size)
+    return "";
+  return &index->strings[offset];
+}
+
+const char *gmeindex_file(const gmeindex_t *index, unsigned int file)
+{
+  if (file >= index->file_count)
+    return "";
+  return string_at(index, read_le32(&index->files[file * 4]));
+}
+
+int gmeindex_track_field(const gmeindex_t *index, unsigned int track,
+  int word)
+{
+  return (int)read_le32(&index->tracks[track * GMEINDEX_TRACK_SIZE + word * 4]);
+}
+
+const char *gmeindex_track_string(const gmeindex_t *index,
+  unsigned int track, int word)
+{
+  return string_at(index, gmeindex_track_field(index, track, word));
+}
+
+static const char *token_string(const gmeindex_t *index, unsigned int token)
+{
+  return string_at(index, read_le32(&index->tokens[token * GMEINDEX_TOKEN_SIZE]));
+}
+
+void gmeindex_match(const gmeindex_t *index, const char *key, int prefix,
+  unsigned char *matches)
+{
+  const unsigned char *token;
+  unsigned int lo, hi, mid;
+  unsigned int first, count, i, track;
+  size_t key_len = strlen(key);
+  int cmp;
+
+  /* binary search for the first token >= key */
+  lo = 0;
+  hi = index->token_count;
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (strcmp(token_string(index, mid), key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* every token from there on that matches is a hit */
+  for (; lo < index->token_count; lo++)
+  {
+    if (prefix)
+      cmp = strncmp(token_string(index, lo), key, key_len);
+    else
+      cmp = strcmp(token_string(index, lo), key);
+    if (cmp != 0)
+      break;
+
+    token = &index->tokens[lo * GMEINDEX_TOKEN_SIZE];
+    first = read_le32(&token[4]);
+    count = read_le32(&token[8]);
+    for (i = 0; i < count; i++)
+    {
+      if (index->postings + (size_t)(first + i + 1) * 4 >
+          (const unsigned char *)index->strings)
+        break;  /* corrupt posting range */
+      track = read_le32(&index->postings[(first + i) * 4]);
+      if (track < index->track_count)
+        matches[track >> 3] |= 1 << (track & 7);
+    }
+  }
+}
@@ -0,0 +1,96 @@
+/*
+ * On-disk metadata index for a library of game music files
+ *
+ * The index is written by gme-index and is designed to be mapped into
+ * memory and searched in place, without parsing and without opening any
+ * music file. All integers are 32-bit little endian; all offsets are
+ * relative to the start of the file.
+ *
+ *   header (GMEINDEX_HEADER_SIZE bytes):
+ *     "Game Music Index" signature (16 bytes)
+ *     version, file count, file table offset, track count, track table
+ *     offset, token count, token table offset, postings offset, string
+ *     pool offset, string pool size
+ *   file table:  one string offset (the path) per file
+ *   track table: GMEINDEX_TRACK_SIZE bytes per track; see GMEINDEX_TRACK_*
+ *   token table: string offset, first posting, posting count; sorted by
+ *                token string (byte order)
+ *   postings:    track indexes, ascending within each token
+ *   string pool: NUL-terminated strings, each stored only once
+ *
+ * A token is "<field>:<word>", where the word is a lowercased run of
+ * letters and digits from that field, e.g. "author:hubbard" or
+ * "type:spc". Searching for a prefix of a token is a binary search for the
+ * first match followed by a scan over the neighbouring tokens.
+ */
+#ifndef GMEINDEX_H
+#define GMEINDEX_H
+
+#include <stddef.h>
+
+#define GMEINDEX_SIGNATURE "Game Music Index"
+#define GMEINDEX_SIGNATURE_SIZE 16
+#define GMEINDEX_VERSION 1
+#define GMEINDEX_HEADER_SIZE (GMEINDEX_SIGNATURE_SIZE + 10 * 4)
+
+/* track record fields, in 32-bit words */
+#define GMEINDEX_TRACK_FILE          0   /* index into the file table */
+#define GMEINDEX_TRACK_NUMBER        1   /* track (or container entry) */
+#define GMEINDEX_TRACK_SYSTEM        2   /* string offsets... */
+#define GMEINDEX_TRACK_GAME          3
+#define GMEINDEX_TRACK_SONG          4
+#define GMEINDEX_TRACK_AUTHOR        5
+#define GMEINDEX_TRACK_COPYRIGHT     6
+#define GMEINDEX_TRACK_DUMPER        7
+#define GMEINDEX_TRACK_TYPE          8
+#define GMEINDEX_TRACK_LENGTH        9   /* ...and times in ms (signed) */
+#define GMEINDEX_TRACK_INTRO_LENGTH 10
+#define GMEINDEX_TRACK_LOOP_LENGTH  11
+#define GMEINDEX_TRACK_PLAY_LENGTH  12
+#define GMEINDEX_TRACK_WORDS        13
+#define GMEINDEX_TRACK_SIZE (GMEINDEX_TRACK_WORDS * 4)
+
+#define GMEINDEX_TOKEN_SIZE 12
+#define GMEINDEX_MAX_TOKEN 64
+
+/* the searchable fields, by name and track record field */
+#define GMEINDEX_FIELD_COUNT 7
+extern const char *gmeindex_field_names[GMEINDEX_FIELD_COUNT];
+extern const int gmeindex_field_words[GMEINDEX_FIELD_COUNT];
+
+typedef struct
+{
+  const unsigned char *data;
+  size_t size;
+  unsigned int file_count;
+  unsigned int track_count;
+  unsigned int token_count;
+  const unsigned char *files;
+  const unsigned char *tracks;
+  const unsigned char *tokens;
+  const unsigned char *postings;
+  const char *strings;
+  size_t strings_size;
+} gmeindex_t;
+
+/* Split text into index words, calling emit() for each lowercased word */
+void gmeindex_tokenize(const char *text,
+  void (*emit)(const char *word, void *context), void *context);
+
+/* Map an index; returns 0 on success */
+int gmeindex_open(gmeindex_t *index, const char *filename);
+void gmeindex_close(gmeindex_t *index);
+
+/* Accessors for mapped records */
+const char *gmeindex_file(const gmeindex_t *index, unsigned int file);
+int gmeindex_track_field(const gmeindex_t *index, unsigned int track,
+  int word);
+const char *gmeindex_track_string(const gmeindex_t *index,
+  unsigned int track, int word);
+
+/* Set a bit in matches (one bit per track) for every track having a token
+ * equal to key, or starting with key if prefix is set. */
+void gmeindex_match(const gmeindex_t *index, const char *key, int prefix,
+  unsigned char *matches);
+
+#endif  /* GMEINDEX_H */
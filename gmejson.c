@@ -0,0 +1,197 @@
+/*
+ * JSON metadata output, shared by gme2json and gme-batch
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <gme/gme.h>
+
+#include "gamemusic.h"
+#include "gmejson.h"
+#include "loudness.h"
+
+/* Print a string surrounded by quotes while escaping any quotes or
+ * backslashes encountered within the string. */
+static void escape_print(FILE *out, const char *str)
+{
+  int i = 0;
+  unsigned char c;
+
+  if (!strlen(str))
+  {
+    fprintf(out, "null");
+    return;
+  }
+
+  putc('"', out);
+  while (str[i])
+  {
+    c = (unsigned char)(str[i++]);
+    if (c > 127)
+    {
+      /* assume high-bit set == Latin-1 */
+      fprintf(out, "\\u00%02X", c);
+    }
+    else if (c < 32)
+    {
+      /* convert control characters to spaces */
+      putc(' ', out);
+    }
+    else if ((c == '"') || (c == '\\'))
+    {
+      /* escape quote and backslash characters */
+      putc('\\', out);
+      putc(c, out);
+    }
+    else
+      putc(c, out);
+  }
+  putc('"', out);
+}
+
+static void print_meta_strings(FILE *out, gme_info_t *info,
+  const loudness_t *loudness, const char *indent)
+{
+  fprintf(out, "%s\"system\": ",    indent);  escape_print(out, info->system);     fprintf(out, ",\n");
+  fprintf(out, "%s\"game\": ",      indent);  escape_print(out, info->game);       fprintf(out, ",\n");
+  fprintf(out, "%s\"song\": ",      indent);  escape_print(out, info->song);       fprintf(out, ",\n");
+  fprintf(out, "%s\"author\": ",    indent);  escape_print(out, info->author);     fprintf(out, ",\n");
+  fprintf(out, "%s\"copyright\": ", indent);  escape_print(out, info->copyright);  fprintf(out, ",\n");
+  fprintf(out, "%s\"comment\": ",   indent);  escape_print(out, info->comment);    fprintf(out, ",\n");
+  fprintf(out, "%s\"dumper\": ",    indent);  escape_print(out, info->dumper);     fprintf(out, ",\n");
+
+  fprintf(out, "%s\"length\": %d,\n",       indent, info->length);
+  fprintf(out, "%s\"intro_length\": %d,\n", indent, info->intro_length);
+  fprintf(out, "%s\"loop_length\": %d,\n",  indent, info->loop_length);
+  fprintf(out, "%s\"play_length\": %d%s\n", indent, info->play_length,
+    loudness ? "," : "");
+
+  if (loudness)
+  {
+    fprintf(out, "%s\"loudness\": %.2f,\n", indent, loudness->loudness);
+    fprintf(out, "%s\"peak\": %.6f,\n",     indent, loudness->peak);
+    fprintf(out, "%s\"gain\": %.2f\n",      indent, loudness->gain);
+  }
+}
+
+static int load_conventional_gme_file(FILE *out, const char *filename)
+{
+  Music_Emu *emu;
+  gme_info_t *info;
+  loudness_t loudness;
+  int track_count;
+  gme_err_t err;
+  int i;
+
+  /* ask the library to only open the file for informational purposes */
+  err = gme_open_file(filename, &emu, gme_info_only);
+  if (err)
+  {
+    printf("%s: %s\n", filename, err);
+    return 2;
+  }
+
+  track_count = gme_track_count(emu);
+  fprintf(out, "{\n");
+  fprintf(out, "  \"track_count\": %d,\n", track_count);
+  fprintf(out, "  \"tracks\":\n  [\n");
+  for (i = 0; i < track_count; i++)
+  {
+    err = gme_track_info(emu, &info, i);
+    if (err)
+    {
+      printf("ERROR\n");
+      gme_delete(emu);
+      return 2;
+    }
+    fprintf(out, "    {\n");
+    print_meta_strings(out, info,
+      loudness_read_track(filename, i, &loudness) ? NULL : &loudness,
+      "      ");
+    fprintf(out, "    }");
+    if (i < track_count - 1)
+      fprintf(out, ",");
+    fprintf(out, "\n");
+    gme_free_info(info);
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+
+  gme_delete(emu);
+
+  return 0;  /* success */
+}
+
+static int load_gamemusic_container_file(FILE *out, const char *filename)
+{
+  gamemusic_t gm;
+  Music_Emu *emu;
+  gme_info_t *info;
+  loudness_t loudness;
+  gme_err_t err;
+  int ret;
+  int i;
+
+  ret = gamemusic_open(&gm, filename);
+  if (ret)
+    return ret;
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"track_count\": %d,\n", gm.entry_count);
+  fprintf(out, "  \"tracks\":\n  [\n");
+  for (i = 0; i < gm.entry_count; i++)
+  {
+    /* open the entry straight out of the mapped file */
+    err = gamemusic_open_emu(&gm, i, &emu, gme_info_only);
+    if (err)
+    {
+      printf("%s: %s\n", filename, err);
+      gamemusic_close(&gm);
+      return 2;
+    }
+
+    err = gme_track_info(emu, &info, 0);
+    if (err)
+    {
+      printf("ERROR\n");
+      gme_delete(emu);
+      gamemusic_close(&gm);
+      return 2;
+    }
+    fprintf(out, "    {\n");
+    print_meta_strings(out, info,
+      loudness_read_track(filename, i, &loudness) ? NULL : &loudness,
+      "      ");
+    fprintf(out, "    }");
+    if (i < gm.entry_count - 1)
+      fprintf(out, ",");
+    fprintf(out, "\n");
+    gme_free_info(info);
+
+    gme_delete(emu);
+  }
+
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+  gamemusic_close(&gm);
+
+  return 0;  /* success */
+}
+
+int gmejson_write(FILE *out, const char *filename)
+{
+  int is_container;
+
+  /* first, check if it's a special .gamemusic container */
+  is_container = gamemusic_is_container(filename);
+  if (is_container < 0)
+  {
+    perror(filename);
+    return 2;
+  }
+
+  if (is_container)
+    return load_gamemusic_container_file(out, filename);
+  else
+    return load_conventional_gme_file(out, filename);
+}
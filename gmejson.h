@@ -0,0 +1,17 @@
+/*
+ * JSON metadata output, shared by gme2json and gme-batch
+ *
+ * The output has a track count and one object per track with the strings
+ * and lengths from gme_info_t, plus the loudness, peak and gain if
+ * gme-loudness has analyzed the file.
+ */
+#ifndef GMEJSON_H
+#define GMEJSON_H
+
+#include <stdio.h>
+
+/* Write the metadata of a conventional GME file or a .gamemusic container
+ * to out; returns 0 on success and 2 if the file could not be read. */
+int gmejson_write(FILE *out, const char *filename);
+
+#endif  /* GMEJSON_H */
@@ -0,0 +1,304 @@
+/*
+ * Loudness measurement and playback gain
+ *
+ * See loudness.h for the measurement and the sidecar format.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "loudness.h"
+
+#define CHANNELS 2
+/* gating blocks are 4 sub-blocks of 100 ms */
+#define SUBBLOCKS_PER_SECOND 10
+#define SUBBLOCKS_PER_BLOCK 4
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+#define LINE_SIZE 256
+
+typedef struct
+{
+  double b0, b1, b2, a1, a2;
+} biquad_t;
+
+typedef struct
+{
+  double x1, x2, y1, y2;
+} biquad_state_t;
+
+/* K-weighting filter coefficients for a given sample rate, derived the
+ * same way as in the BS.1770 reference filters (which are only given for
+ * 48 kHz) */
+static void k_weighting(int sample_rate, biquad_t *shelf, biquad_t *highpass)
+{
+  double f0, gain, q, k, vh, vb, a0;
+
+  /* stage 1: high shelf modelling the acoustic effect of the head */
+  f0 = 1681.974450955533;
+  gain = 3.999843853973347;
+  q = 0.7071752369554196;
+  k = tan(M_PI * f0 / sample_rate);
+  vh = pow(10.0, gain / 20.0);
+  vb = pow(vh, 0.4996667741545416);
+  a0 = 1.0 + k / q + k * k;
+  shelf->b0 = (vh + vb * k / q + k * k) / a0;
+  shelf->b1 = 2.0 * (k * k - vh) / a0;
+  shelf->b2 = (vh - vb * k / q + k * k) / a0;
+  shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+  shelf->a2 = (1.0 - k / q + k * k) / a0;
+
+  /* stage 2: RLB high pass */
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / sample_rate);
+  a0 = 1.0 + k / q + k * k;
+  highpass->b0 = 1.0;
+  highpass->b1 = -2.0;
+  highpass->b2 = 1.0;
+  highpass->a1 = 2.0 * (k * k - 1.0) / a0;
+  highpass->a2 = (1.0 - k / q + k * k) / a0;
+}
+
+static double biquad(const biquad_t *f, biquad_state_t *s, double x)
+{
+  double y;
+
+  y = f->b0 * x + f->b1 * s->x1 + f->b2 * s->x2 - f->a1 * s->y1 - f->a2 * s->y2;
+  s->x2 = s->x1;
+  s->x1 = x;
+  s->y2 = s->y1;
+  s->y1 = y;
+
+  return y;
+}
+
+static double energy_to_lufs(double energy)
+{
+  if (energy <= 0.0)
+    return ABSOLUTE_GATE;
+  return -0.691 + 10.0 * log10(energy);
+}
+
+/* Gated loudness from the mean square of each 100 ms sub-block */
+static double gated_loudness(const double *subblocks, int count)
+{
+  double block, sum, threshold;
+  int blocks, i, j, n;
+
+  blocks = count - SUBBLOCKS_PER_BLOCK + 1;
+  if (blocks < 1)
+  {
+    /* shorter than one gating block; measure what there is */
+    sum = 0.0;
+    for (i = 0; i < count; i++)
+      sum += subblocks[i];
+    return (count > 0) ? energy_to_lufs(sum / count) : ABSOLUTE_GATE;
+  }
+
+  /* two passes: first the absolute gate, then the relative one */
+  threshold = ABSOLUTE_GATE;
+  for (j = 0; j < 2; j++)
+  {
+    sum = 0.0;
+    n = 0;
+    for (i = 0; i < blocks; i++)
+    {
+      block = (subblocks[i] + subblocks[i + 1] + subblocks[i + 2] +
+        subblocks[i + 3]) / SUBBLOCKS_PER_BLOCK;
+      if (energy_to_lufs(block) > threshold)
+      {
+        sum += block;
+        n++;
+      }
+    }
+    if (!n)
+      return ABSOLUTE_GATE;
+    /* a block has to pass both gates, so the relative threshold never
+     * drops below the absolute one */
+    threshold = energy_to_lufs(sum / n) + RELATIVE_GATE;
+    if (threshold < ABSOLUTE_GATE)
+      threshold = ABSOLUTE_GATE;
+  }
+
+  return energy_to_lufs(sum / n);
+}
+
+gme_err_t loudness_analyze(Music_Emu *emu, int sample_rate, int length_ms,
+  loudness_t *result)
+{
+  biquad_t shelf, highpass;
+  biquad_state_t state[CHANNELS][2];
+  short *buffer;
+  double *subblocks;
+  double energy, y;
+  int subblock_frames;
+  int count, i, j;
+  int peak = 0;
+  gme_err_t err = NULL;
+
+  k_weighting(sample_rate, &shelf, &highpass);
+  memset(state, 0, sizeof(state));
+
+  subblock_frames = sample_rate / SUBBLOCKS_PER_SECOND;
+  count = (int)((double)length_ms * SUBBLOCKS_PER_SECOND / 1000);
+  buffer = (short *)malloc(subblock_frames * CHANNELS * sizeof(short));
+  subblocks = (double *)malloc((count + 1) * sizeof(double));
+  if (!buffer || !subblocks)
+  {
+    free(buffer);
+    free(subblocks);
+    return "Out of memory";
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    err = gme_play(emu, subblock_frames * CHANNELS, buffer);
+    if (err)
+      break;
+
+    energy = 0.0;
+    for (j = 0; j < subblock_frames * CHANNELS; j++)
+    {
+      if (abs(buffer[j]) > peak)
+        peak = abs(buffer[j]);
+      y = biquad(&shelf, &state[j & 1][0], buffer[j] / 32768.0);
+      y = biquad(&highpass, &state[j & 1][1], y);
+      energy += y * y;
+    }
+    /* channel weights are 1.0 for left and right, so the per-channel mean
+     * squares simply add up */
+    subblocks[i] = energy / subblock_frames;
+  }
+
+  if (!err)
+  {
+    result->loudness = gated_loudness(subblocks, count);
+    result->peak = peak / 32768.0;
+    result->gain = LOUDNESS_TARGET - result->loudness;
+    /* don't let the gain push the loudest sample past full scale */
+    if (!peak)
+      result->gain = 0.0;
+    else if (result->gain > -20.0 * log10(result->peak))
+      result->gain = -20.0 * log10(result->peak);
+  }
+
+  free(buffer);
+  free(subblocks);
+
+  return err;
+}
+
+int loudness_write_file(const char *filename, const loudness_t *results,
+  int count)
+{
+  char *sidecar;
+  FILE *f;
+  int i;
+
+  sidecar = (char *)malloc(strlen(filename) + strlen(LOUDNESS_EXTENSION) + 1);
+  if (!sidecar)
+    return 3;
+  sprintf(sidecar, "%s%s", filename, LOUDNESS_EXTENSION);
+
+  f = fopen(sidecar, "w");
+  if (!f)
+  {
+    perror(sidecar);
+    free(sidecar);
+    return 2;
+  }
+  for (i = 0; i < count; i++)
+    fprintf(f, "%d %.2f %.6f %.2f\n", results[i].track, results[i].loudness,
+      results[i].peak, results[i].gain);
+  fclose(f);
+  free(sidecar);
+
+  return 0;
+}
+
+int loudness_read_track(const char *filename, int track, loudness_t *result)
+{
+  char line[LINE_SIZE];
+  char *sidecar;
+  loudness_t entry;
+  FILE *f;
+  int found = 0;
+
+  sidecar = (char *)malloc(strlen(filename) + strlen(LOUDNESS_EXTENSION) + 1);
+  if (!sidecar)
+    return 3;
+  sprintf(sidecar, "%s%s", filename, LOUDNESS_EXTENSION);
+  f = fopen(sidecar, "r");
+  free(sidecar);
+  if (!f)
+    return 1;  /* not analyzed; not an error */
+
+  while (!found && fgets(line, LINE_SIZE, f))
+  {
+    if (sscanf(line, "%d %f %f %f", &entry.track, &entry.loudness,
+      &entry.peak, &entry.gain) == 4 && entry.track == track)
+    {
+      *result = entry;
+      found = 1;
+    }
+  }
+  fclose(f);
+
+  return found ? 0 : 1;
+}
+
+int loudness_gain_to_fixed(float gain_db)
+{
+  double gain;
+
+  gain = pow(10.0, gain_db / 20.0) * LOUDNESS_GAIN_UNITY + 0.5;
+  if (gain > 32767.0)
+    gain = 32767.0;
+
+  return (int)gain;
+}
+
+void loudness_apply_gain(short *samples, int count, int gain)
+{
+  int i = 0;
+  int v;
+
+  if (gain == LOUDNESS_GAIN_UNITY)
+    return;
+
+#ifdef __SSE2__
+  {
+    /* 8 samples at a time: form the full 32-bit products from the low and
+     * high halves, shift them back down and let the signed pack saturate */
+    __m128i g = _mm_set1_epi16((short)gain);
+    __m128i x, lo, hi;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      x = _mm_loadu_si128((__m128i *)&samples[i]);
+      lo = _mm_mullo_epi16(x, g);
+      hi = _mm_mulhi_epi16(x, g);
+      x = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), LOUDNESS_GAIN_SHIFT),
+        _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), LOUDNESS_GAIN_SHIFT));
+      _mm_storeu_si128((__m128i *)&samples[i], x);
+    }
+  }
+#endif
+
+  for (; i < count; i++)
+  {
+    v = (samples[i] * gain) >> LOUDNESS_GAIN_SHIFT;
+    if (v > 32767)
+      v = 32767;
+    else if (v < -32768)
+      v = -32768;
+    samples[i] = v;
+  }
+}
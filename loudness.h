@@ -0,0 +1,56 @@
+/*
+ * Loudness measurement and playback gain
+ *
+ * Integrated loudness follows ITU-R BS.1770: K-weighting, 400 ms blocks
+ * overlapping by 75%, an absolute gate at -70 LUFS and a relative gate
+ * 10 LU below the absolute-gated level. The peak is the largest sample
+ * magnitude, relative to full scale.
+ *
+ * Results for a file are kept next to it in "<file>.loudness", one line
+ * per track:
+ *
+ *   <track> <loudness in LUFS> <peak, 0.0-1.0> <gain in dB>
+ *
+ * with tracks numbered the same way as the players and gme2json number
+ * them (container entries for .gamemusic files).
+ */
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <gme/gme.h>
+
+#define LOUDNESS_EXTENSION ".loudness"
+/* level that playback gain brings every track to */
+#define LOUDNESS_TARGET -18.0
+/* fixed-point format of gain values passed to loudness_apply_gain() */
+#define LOUDNESS_GAIN_SHIFT 12
+#define LOUDNESS_GAIN_UNITY (1 << LOUDNESS_GAIN_SHIFT)
+
+typedef struct
+{
+  int track;
+  float loudness;
+  float peak;
+  float gain;
+} loudness_t;
+
+/* Measure length_ms of interleaved stereo from an emulator whose track has
+ * already been started. Silence measures as -70 LUFS. */
+gme_err_t loudness_analyze(Music_Emu *emu, int sample_rate, int length_ms,
+  loudness_t *result);
+
+/* Write the results for a whole file to its sidecar; returns 0 on success */
+int loudness_write_file(const char *filename, const loudness_t *results,
+  int count);
+
+/* Look up one track in a file's sidecar; returns 0 if it was found */
+int loudness_read_track(const char *filename, int track, loudness_t *result);
+
+/* Convert a gain in dB to the fixed-point format below, limited to what
+ * the format can hold (about +18 dB) */
+int loudness_gain_to_fixed(float gain_db);
+
+/* Scale samples in place by a fixed-point gain, saturating at full scale */
+void loudness_apply_gain(short *samples, int count, int gain);
+
+#endif  /* LOUDNESS_H */
@@ -0,0 +1,81 @@
+/*
+ * Minimal parallel-for over a fixed list of independent jobs
+ */
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  int next_job;
+  int job_count;
+  parallel_job_fn job;
+  void *context;
+} parallel_state_t;
+
+static void *parallel_worker(void *arg)
+{
+  parallel_state_t *state = (parallel_state_t *)arg;
+  int index;
+
+  while (1)
+  {
+    pthread_mutex_lock(&state->lock);
+    index = state->next_job++;
+    pthread_mutex_unlock(&state->lock);
+    if (index >= state->job_count)
+      break;
+    state->job(index, state->context);
+  }
+
+  return NULL;
+}
+
+int parallel_cpu_count(void)
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (count < 1) ? 1 : (int)count;
+}
+
+void parallel_run(int thread_count, int job_count, parallel_job_fn job,
+  void *context)
+{
+  parallel_state_t state;
+  pthread_t *threads;
+  int started = 0;
+  int i;
+
+  if (thread_count < 1)
+    thread_count = parallel_cpu_count();
+  if (thread_count > job_count)
+    thread_count = job_count;
+
+  pthread_mutex_init(&state.lock, NULL);
+  state.next_job = 0;
+  state.job_count = job_count;
+  state.job = job;
+  state.context = context;
+
+  /* the calling thread is one of the workers */
+  threads = (pthread_t *)malloc(thread_count * sizeof(pthread_t));
+  if (threads)
+  {
+    for (i = 1; i < thread_count; i++)
+    {
+      if (pthread_create(&threads[started], NULL, parallel_worker, &state))
+        break;
+      started++;
+    }
+  }
+  parallel_worker(&state);
+
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  pthread_mutex_destroy(&state.lock);
+}
@@ -0,0 +1,20 @@
+/*
+ * Minimal parallel-for over a fixed list of independent jobs
+ *
+ * Jobs are handed out in index order to whichever thread asks next, so a
+ * caller that wants the longest jobs to start first only has to sort them.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+typedef void (*parallel_job_fn)(int index, void *context);
+
+/* Number of online CPUs; at least 1 */
+int parallel_cpu_count(void);
+
+/* Run job(0..job_count-1) across thread_count threads (0 means one per
+ * CPU) and return once every job has finished. */
+void parallel_run(int thread_count, int job_count, parallel_job_fn job,
+  void *context);
+
+#endif  /* PARALLEL_H */
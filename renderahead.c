@@ -0,0 +1,398 @@
+/*
+ * Render-ahead stage: emulate on worker threads, play from a queue
+ *
+ * See renderahead.h for an overview. All pool and stream state is guarded
+ * by the single pool mutex; it is never held while emulating.
+ */
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "loudness.h"
+#include "renderahead.h"
+
+struct renderahead_stream
+{
+  renderahead_pool_t *pool;
+  renderahead_stream_t *next;
+
+  Music_Emu *emu;
+  int limit_ms;
+  int gain;
+
+  /* chunk_count chunks of chunk_size samples; the filled chunks run from
+   * head for filled chunks (wrapping), and the chunk at head is the one
+   * the consumer is holding, if any */
+  short *buffers;
+  int chunk_size;
+  int chunk_count;
+  int head;
+  int filled;
+
+  /* refills start once the queue is down to low_water chunks and carry on
+   * until it is full */
+  int low_water;
+  int refilling;
+  void (*notify)(void *context);
+  void *notify_context;
+
+  int rendering;  /* a worker is inside the emulator */
+  int paused;
+  int finished;
+  int delivered;  /* at least one chunk went out since (re)starting */
+  gme_err_t error;
+  unsigned long underruns;
+
+  /* signalled whenever a chunk is filled or a worker leaves the emulator */
+  pthread_cond_t cond;
+};
+
+struct renderahead_pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* signalled when there may be something to render */
+  pthread_t *threads;
+  int thread_count;
+  renderahead_stream_t *streams;
+  int shutdown;
+};
+
+/* Pick the stream with the emptiest queue that can take another chunk;
+ * called with the pool locked. */
+static renderahead_stream_t *pick_stream(renderahead_pool_t *pool)
+{
+  renderahead_stream_t *stream;
+  renderahead_stream_t *best = NULL;
+
+  for (stream = pool->streams; stream; stream = stream->next)
+  {
+    if (stream->rendering || stream->paused || stream->finished ||
+        stream->filled >= stream->chunk_count ||
+        (!stream->refilling && stream->filled > stream->low_water))
+      continue;
+    if (!best || stream->filled * best->chunk_count <
+                 best->filled * stream->chunk_count)
+      best = stream;
+  }
+
+  return best;
+}
+
+static void *render_worker(void *arg)
+{
+  renderahead_pool_t *pool = (renderahead_pool_t *)arg;
+  renderahead_stream_t *stream;
+  Music_Emu *emu;
+  short *chunk;
+  gme_err_t err;
+  void (*notify)(void *context);
+  void *notify_context;
+  int gain;
+  int done;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->shutdown)
+  {
+    stream = pick_stream(pool);
+    if (!stream)
+    {
+      pthread_cond_wait(&pool->work, &pool->lock);
+      continue;
+    }
+
+    /* the chunk just past the filled ones is free; nobody else touches it
+     * until it is counted as filled */
+    chunk = &stream->buffers[((stream->head + stream->filled) %
+      stream->chunk_count) * stream->chunk_size];
+    emu = stream->emu;
+    gain = stream->gain;
+    stream->rendering = 1;
+    stream->refilling = 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    err = gme_play(emu, stream->chunk_size, chunk);
+    done = !err && stream->limit_ms && gme_tell(emu) >= stream->limit_ms;
+    loudness_apply_gain(chunk, stream->chunk_size, gain);
+
+    pthread_mutex_lock(&pool->lock);
+    stream->rendering = 0;
+    if (err)
+    {
+      stream->error = err;
+      stream->finished = 1;
+    }
+    else
+    {
+      stream->filled++;
+      stream->finished = done;
+    }
+    if (stream->filled >= stream->chunk_count || stream->finished)
+      stream->refilling = 0;
+    pthread_cond_broadcast(&stream->cond);
+
+    if (stream->finished && stream->notify)
+    {
+      notify = stream->notify;
+      notify_context = stream->notify_context;
+      pthread_mutex_unlock(&pool->lock);
+      notify(notify_context);
+      pthread_mutex_lock(&pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+renderahead_pool_t *renderahead_pool_create(int thread_count)
+{
+  renderahead_pool_t *pool;
+  int i;
+
+  if (thread_count < 1)
+    thread_count = 1;
+
+  pool = (renderahead_pool_t *)calloc(1, sizeof(renderahead_pool_t));
+  if (!pool)
+    return NULL;
+  pool->threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+  if (!pool->threads)
+  {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+
+  for (i = 0; i < thread_count; i++)
+  {
+    if (pthread_create(&pool->threads[i], NULL, render_worker, pool))
+      break;
+    pool->thread_count++;
+  }
+  if (!pool->thread_count)
+  {
+    renderahead_pool_destroy(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+void renderahead_pool_destroy(renderahead_pool_t *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->thread_count; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
+
+renderahead_stream_t *renderahead_stream_create(renderahead_pool_t *pool,
+  Music_Emu *emu, int limit_ms, int gain, int chunk_size, int chunk_count)
+{
+  renderahead_stream_t *stream;
+
+  if (chunk_count < 2)
+    chunk_count = 2;
+
+  stream = (renderahead_stream_t *)calloc(1, sizeof(renderahead_stream_t));
+  if (!stream)
+    return NULL;
+  stream->buffers = (short *)malloc(chunk_size * chunk_count * sizeof(short));
+  if (!stream->buffers)
+  {
+    free(stream);
+    return NULL;
+  }
+  stream->pool = pool;
+  stream->emu = emu;
+  stream->limit_ms = limit_ms;
+  stream->gain = gain;
+  stream->chunk_size = chunk_size;
+  stream->chunk_count = chunk_count;
+  stream->low_water = chunk_count - 1;
+  pthread_cond_init(&stream->cond, NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  stream->next = pool->streams;
+  pool->streams = stream;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  return stream;
+}
+
+void renderahead_stream_destroy(renderahead_stream_t *stream)
+{
+  renderahead_pool_t *pool = stream->pool;
+  renderahead_stream_t **link;
+
+  renderahead_pause(stream);
+
+  pthread_mutex_lock(&pool->lock);
+  for (link = &pool->streams; *link; link = &(*link)->next)
+  {
+    if (*link == stream)
+    {
+      *link = stream->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_cond_destroy(&stream->cond);
+  free(stream->buffers);
+  free(stream);
+}
+
+const short *renderahead_dequeue(renderahead_stream_t *stream, int *samples,
+  int wait)
+{
+  renderahead_pool_t *pool = stream->pool;
+  const short *chunk = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (!stream->filled && !stream->finished && stream->delivered && !wait)
+    stream->underruns++;
+  while (!stream->filled && !stream->finished && wait)
+    pthread_cond_wait(&stream->cond, &pool->lock);
+
+  if (stream->filled)
+  {
+    chunk = &stream->buffers[stream->head * stream->chunk_size];
+    *samples = stream->chunk_size;
+    stream->delivered = 1;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return chunk;
+}
+
+void renderahead_set_notify(renderahead_stream_t *stream, int low_water,
+  void (*notify)(void *context), void *context)
+{
+  pthread_mutex_lock(&stream->pool->lock);
+  if (low_water < 0)
+    low_water = 0;
+  if (low_water > stream->chunk_count - 1)
+    low_water = stream->chunk_count - 1;
+  stream->low_water = low_water;
+  stream->notify = notify;
+  stream->notify_context = context;
+  pthread_mutex_unlock(&stream->pool->lock);
+}
+
+void renderahead_release(renderahead_stream_t *stream)
+{
+  renderahead_pool_t *pool = stream->pool;
+  void (*notify)(void *context) = NULL;
+  void *notify_context = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (stream->filled)
+  {
+    stream->head = (stream->head + 1) % stream->chunk_count;
+    stream->filled--;
+
+    /* the queue just drained to the low water mark: time to refill */
+    if (stream->filled == stream->low_water)
+    {
+      pthread_cond_signal(&pool->work);
+      notify = stream->notify;
+      notify_context = stream->notify_context;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (notify)
+    notify(notify_context);
+}
+
+void renderahead_pause(renderahead_stream_t *stream)
+{
+  renderahead_pool_t *pool = stream->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  stream->paused = 1;
+  while (stream->rendering)
+    pthread_cond_wait(&stream->cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void renderahead_resume(renderahead_stream_t *stream)
+{
+  renderahead_pool_t *pool = stream->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  stream->paused = 0;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void renderahead_restart(renderahead_stream_t *stream, Music_Emu *emu,
+  int limit_ms, int gain)
+{
+  renderahead_pool_t *pool = stream->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  stream->emu = emu;
+  stream->limit_ms = limit_ms;
+  stream->gain = gain;
+  stream->head = 0;
+  stream->filled = 0;
+  stream->finished = 0;
+  stream->refilling = 0;
+  stream->delivered = 0;
+  stream->error = NULL;
+  stream->paused = 0;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int renderahead_queued(renderahead_stream_t *stream)
+{
+  int queued;
+
+  pthread_mutex_lock(&stream->pool->lock);
+  queued = stream->filled * stream->chunk_size;
+  pthread_mutex_unlock(&stream->pool->lock);
+
+  return queued;
+}
+
+int renderahead_capacity(renderahead_stream_t *stream)
+{
+  return stream->chunk_count * stream->chunk_size;
+}
+
+unsigned long renderahead_underruns(renderahead_stream_t *stream)
+{
+  unsigned long underruns;
+
+  pthread_mutex_lock(&stream->pool->lock);
+  underruns = stream->underruns;
+  pthread_mutex_unlock(&stream->pool->lock);
+
+  return underruns;
+}
+
+gme_err_t renderahead_error(renderahead_stream_t *stream)
+{
+  gme_err_t error;
+
+  pthread_mutex_lock(&stream->pool->lock);
+  error = stream->error;
+  pthread_mutex_unlock(&stream->pool->lock);
+
+  return error;
+}
@@ -0,0 +1,71 @@
+/*
+ * Render-ahead stage: emulate on worker threads, play from a queue
+ *
+ * A pool of worker threads keeps a queue of rendered PCM topped up for
+ * each stream. Every stream owns a fixed ring of equally sized chunks that
+ * is allocated when the stream is created, so nothing is allocated or
+ * copied on the way to the device: workers call gme_play() straight into
+ * a free chunk and the output thread hands the oldest filled chunk to the
+ * device, then releases it back to the ring.
+ *
+ * A stream is only ever rendered by one worker at a time since an emulator
+ * is not thread-safe; extra workers serve other streams.
+ */
+#ifndef RENDERAHEAD_H
+#define RENDERAHEAD_H
+
+#include <gme/gme.h>
+
+typedef struct renderahead_pool renderahead_pool_t;
+typedef struct renderahead_stream renderahead_stream_t;
+
+renderahead_pool_t *renderahead_pool_create(int thread_count);
+void renderahead_pool_destroy(renderahead_pool_t *pool);
+
+/* Queue up to chunk_count chunks of chunk_size samples (not frames) from
+ * emu. Rendering stops once gme_tell() reaches limit_ms; pass 0 to render
+ * indefinitely. Rendered audio is scaled by gain, in the fixed-point format
+ * of loudness_apply_gain(). Returns NULL if the buffers can't be
+ * allocated. */
+renderahead_stream_t *renderahead_stream_create(renderahead_pool_t *pool,
+  Music_Emu *emu, int limit_ms, int gain, int chunk_size, int chunk_count);
+void renderahead_stream_destroy(renderahead_stream_t *stream);
+
+/* Let the queue drain to low_water chunks before the workers top it back
+ * up (by default, they refill as soon as a single chunk is free), and call
+ * notify(context) whenever it does drain that far and when the stream
+ * ends. notify is called from the output or a worker thread, without any
+ * lock held. */
+void renderahead_set_notify(renderahead_stream_t *stream, int low_water,
+  void (*notify)(void *context), void *context);
+
+/* Get the oldest rendered chunk. When wait is set, block until one is
+ * ready; otherwise an empty queue returns NULL right away and is counted
+ * as an underrun. NULL with wait set means the stream has ended (check
+ * renderahead_error()). The chunk stays valid until it is released. */
+const short *renderahead_dequeue(renderahead_stream_t *stream, int *samples,
+  int wait);
+void renderahead_release(renderahead_stream_t *stream);
+
+/* Stop rendering and wait for any worker to leave the emulator so that
+ * the caller may use it (mute voices, start another track, etc.). */
+void renderahead_pause(renderahead_stream_t *stream);
+
+/* Continue after a pause, keeping the audio already queued. */
+void renderahead_resume(renderahead_stream_t *stream);
+
+/* Continue after a pause with a new emulator (or a newly started track),
+ * discarding the queued audio. The caller must not be holding a dequeued
+ * chunk. */
+void renderahead_restart(renderahead_stream_t *stream, Music_Emu *emu,
+  int limit_ms, int gain);
+
+/* Queue statistics, for reporting */
+int renderahead_queued(renderahead_stream_t *stream);
+int renderahead_capacity(renderahead_stream_t *stream);
+unsigned long renderahead_underruns(renderahead_stream_t *stream);
+
+/* The error that ended the stream, if any */
+gme_err_t renderahead_error(renderahead_stream_t *stream);
+
+#endif  /* RENDERAHEAD_H */
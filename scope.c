@@ -0,0 +1,54 @@
+/*
+ * Oscilloscope drawing shared by the SDL player and the headless renderer
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "scope.h"
+
+#define CHANNELS 2
+
+void scope_color_init(scope_color_t *color, unsigned int seed)
+{
+  color->r_color = color->g_color = color->b_color = 250;
+  srand(seed);
+  color->r_inc = -1 * (rand() % 3 + 1);
+  color->g_inc = -1 * (rand() % 3 + 1);
+  color->b_inc = -1 * (rand() % 3 + 1);
+}
+
+unsigned int scope_color_next(scope_color_t *color)
+{
+  unsigned int pixel;
+
+  pixel = (color->r_color << 16) | (color->g_color << 8) | (color->b_color << 0);
+  color->r_color += color->r_inc;
+  if (color->r_color <  64 || color->r_color > 250)
+    color->r_inc *= -1;
+  color->g_color += color->g_inc;
+  if (color->g_color < 192 || color->g_color > 250)
+    color->g_inc *= -1;
+  color->b_color += color->b_inc;
+  if (color->b_color < 128 || color->b_color > 250)
+    color->b_inc *= -1;
+
+  return pixel;
+}
+
+void scope_draw(unsigned int *pixels, int pitch, const short *samples,
+  unsigned int pixel)
+{
+  int i;
+
+  for (i = 0; i < SCOPE_HEIGHT; i++)
+    memset(&pixels[i * pitch], 0, SCOPE_WIDTH * sizeof(unsigned int));
+  for (i = 0; i < SCOPE_WIDTH * CHANNELS; i++)
+  {
+    if (i & 1)  /* right channel data */
+      pixels[pitch * ((192 - (samples[i] / 512)) - 1) + (i >> 1)] = pixel;
+    else        /* left channel data */
+      pixels[pitch * (64 - (samples[i] / 512)) + (i >> 1)] = pixel;
+  }
+  for (i = 0; i < SCOPE_WIDTH; i++)
+    pixels[128 * pitch + i] = 0xFFFFFFFF;
+}
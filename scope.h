@@ -0,0 +1,31 @@
+/*
+ * Oscilloscope drawing shared by the SDL player and the headless renderer
+ *
+ * The left channel is drawn in the top half and the right channel in the
+ * bottom half of a SCOPE_WIDTH x SCOPE_HEIGHT image of 0x00RRGGBB pixels,
+ * one stereo sample per column. The trace colour drifts a little from
+ * frame to frame.
+ */
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#define SCOPE_WIDTH 512
+#define SCOPE_HEIGHT 256
+
+typedef struct
+{
+  unsigned char r_color, g_color, b_color;
+  char r_inc, g_inc, b_inc;
+} scope_color_t;
+
+/* Start the colour cycle; the seed picks how fast each component drifts */
+void scope_color_init(scope_color_t *color, unsigned int seed);
+
+/* Return the colour for the next frame */
+unsigned int scope_color_next(scope_color_t *color);
+
+/* Draw SCOPE_WIDTH interleaved stereo samples; pitch is in pixels */
+void scope_draw(unsigned int *pixels, int pitch, const short *samples,
+  unsigned int pixel);
+
+#endif  /* SCOPE_H */
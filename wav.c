@@ -0,0 +1,102 @@
+/*
+ * Minimal writer for 16-bit PCM .wav files
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "wav.h"
+
+#define HEADER_SIZE 44
+
+static void put_le16(unsigned char *p, unsigned int value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+}
+
+static void put_le32(unsigned char *p, unsigned int value)
+{
+  put_le16(&p[0], value & 0xFFFF);
+  put_le16(&p[2], value >> 16);
+}
+
+FILE *wav_open(const char *filename, int sample_rate, int channels)
+{
+  unsigned char header[HEADER_SIZE];
+  FILE *f;
+
+  f = fopen(filename, "wb");
+  if (!f)
+  {
+    perror(filename);
+    return NULL;
+  }
+
+  /* RIFF and data sizes are left at 0 until wav_close() */
+  memcpy(&header[0], "RIFF", 4);
+  put_le32(&header[4], 0);
+  memcpy(&header[8], "WAVEfmt ", 8);
+  put_le32(&header[16], 16);
+  put_le16(&header[20], 1);  /* PCM */
+  put_le16(&header[22], channels);
+  put_le32(&header[24], sample_rate);
+  put_le32(&header[28], sample_rate * channels * 2);
+  put_le16(&header[32], channels * 2);
+  put_le16(&header[34], 16);
+  memcpy(&header[36], "data", 4);
+  put_le32(&header[40], 0);
+
+  if (fwrite(header, HEADER_SIZE, 1, f) != 1)
+  {
+    perror(filename);
+    fclose(f);
+    return NULL;
+  }
+
+  return f;
+}
+
+int wav_write(FILE *f, const short *samples, int count)
+{
+  unsigned char buffer[4096];
+  int i, n;
+
+  /* .wav data is little endian whatever the host is */
+  while (count > 0)
+  {
+    n = (count > (int)sizeof(buffer) / 2) ? (int)sizeof(buffer) / 2 : count;
+    for (i = 0; i < n; i++)
+      put_le16(&buffer[i * 2], (unsigned short)samples[i]);
+    if (fwrite(buffer, n * 2, 1, f) != 1)
+      return 1;
+    samples += n;
+    count -= n;
+  }
+
+  return 0;
+}
+
+int wav_close(FILE *f)
+{
+  unsigned char size[4];
+  long length;
+  int ret = 0;
+
+  length = ftell(f);
+  if (length < HEADER_SIZE)
+    ret = 1;
+  else
+  {
+    put_le32(size, length - 8);
+    if (fseek(f, 4, SEEK_SET) || fwrite(size, 4, 1, f) != 1)
+      ret = 1;
+    put_le32(size, length - HEADER_SIZE);
+    if (fseek(f, 40, SEEK_SET) || fwrite(size, 4, 1, f) != 1)
+      ret = 1;
+  }
+
+  if (fclose(f))
+    ret = 1;
+
+  return ret;
+}
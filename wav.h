@@ -0,0 +1,18 @@
+/*
+ * Minimal writer for 16-bit PCM .wav files
+ */
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdio.h>
+
+/* Create a .wav file; the header is completed by wav_close() */
+FILE *wav_open(const char *filename, int sample_rate, int channels);
+
+/* Append interleaved samples; returns 0 on success */
+int wav_write(FILE *f, const short *samples, int count);
+
+/* Fill in the sizes in the header and close; returns 0 on success */
+int wav_close(FILE *f);
+
+#endif  /* WAV_H */